@@ -0,0 +1,85 @@
+/*
+ * Admission control for background jobs.
+ *
+ * The job limit is checked against the number of running background
+ * jobs that cush.c passes in; the load and memory pressure are read
+ * from /proc each time a queued job could start, which is at most
+ * once per batch of reaped children or per poll of the event loop.
+ */
+
+#include <stdio.h>
+
+#include "admission.h"
+
+struct admission_limits admission_limits;
+
+/* Read one floating point number from 'path' with 'fmt' */
+static double
+read_proc_double(const char *path, const char *fmt)
+{
+    FILE *f = fopen(path, "re");
+    if (f == NULL)
+        return -1;
+    double value;
+    int n = fscanf(f, fmt, &value);
+    fclose(f);
+    return n == 1 ? value : -1;
+}
+
+double
+admission_loadavg(void)
+{
+    return read_proc_double("/proc/loadavg", "%lf");
+}
+
+double
+admission_memory_pressure(void)
+{
+    return read_proc_double("/proc/pressure/memory", "some avg10=%lf");
+}
+
+bool
+admission_allows(int running)
+{
+    if (admission_limits.max_jobs > 0 && running >= admission_limits.max_jobs)
+        return false;
+    if (running == 0)
+        return true;
+    if (admission_limits.max_load > 0 && admission_loadavg() >= admission_limits.max_load)
+        return false;
+    if (admission_limits.max_pressure > 0 &&
+        admission_memory_pressure() >= admission_limits.max_pressure)
+        return false;
+    return true;
+}
+
+bool
+admission_polls(void)
+{
+    return admission_limits.max_load > 0 || admission_limits.max_pressure > 0;
+}
+
+/* Print one limit, or "off" if it is not set */
+static void
+print_limit(FILE *out, const char *name, double limit, double current)
+{
+    if (limit > 0)
+        fprintf(out, "%-9s %-8g", name, limit);
+    else
+        fprintf(out, "%-9s %-8s", name, "off");
+    if (current >= 0)
+        fprintf(out, " now %.2f", current);
+    fprintf(out, "\n");
+}
+
+void
+admission_print(FILE *out)
+{
+    if (admission_limits.max_jobs > 0)
+        fprintf(out, "%-9s %d\n", "jobs", admission_limits.max_jobs);
+    else
+        fprintf(out, "%-9s %s\n", "jobs", "off");
+    print_limit(out, "load", admission_limits.max_load, admission_loadavg());
+    print_limit(out, "pressure", admission_limits.max_pressure,
+                admission_memory_pressure());
+}
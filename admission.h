@@ -0,0 +1,39 @@
+#ifndef __ADMISSION_H
+#define __ADMISSION_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Admission control for background jobs.  A background job only
+ * starts if fewer than 'max_jobs' background jobs run and the system
+ * is not busier than the thresholds below; otherwise it waits in the
+ * shell's run queue.  A limit of 0 is no limit. */
+struct admission_limits {
+    int max_jobs;               /* Background jobs that run at once */
+    double max_load;            /* 1-minute load average, /proc/loadavg */
+    double max_pressure;        /* % of time tasks stalled on memory over
+                                   the last 10s, /proc/pressure/memory */
+};
+
+extern struct admission_limits admission_limits;
+
+/* True if another background job may start while 'running' of them
+ * run.  The load and pressure thresholds only hold jobs back while
+ * some are running, so a busy system cannot keep the queue waiting
+ * forever. */
+bool admission_allows(int running);
+
+/* True if admission depends on the load or the memory pressure,
+ * which change without the shell noticing and must be polled */
+bool admission_polls(void);
+
+/* The 1-minute load average, or -1 if it cannot be read */
+double admission_loadavg(void);
+
+/* The memory pressure "some avg10", or -1 if the kernel has no PSI */
+double admission_memory_pressure(void);
+
+/* Print the limits and the current load and pressure */
+void admission_print(FILE *out);
+
+#endif /* __ADMISSION_H */
@@ -0,0 +1,125 @@
+/*
+ * A simple bump-pointer arena.
+ *
+ * Memory comes from a list of chunks that grow geometrically.  The
+ * first chunk is allocated together with the arena itself, so a
+ * typical command line costs a single malloc().
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdalign.h>
+#include <assert.h>
+
+#include "arena.h"
+#include "utils.h"
+
+#define ARENA_FIRST_CHUNK 2048
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_chunk {
+    struct arena_chunk *next;   /* Previously filled chunk */
+    size_t size;                /* Usable bytes in data[] */
+    size_t used;                /* Bytes handed out from data[] */
+    alignas(max_align_t) char data[];
+};
+
+struct arena {
+    struct arena_chunk *chunks; /* Current chunk, heads the list */
+    int refs;
+};
+
+/* Allocate a new chunk with at least 'size' usable bytes */
+static struct arena_chunk *
+chunk_create(size_t size)
+{
+    struct arena_chunk *c = malloc(sizeof *c + size);
+    if (c == NULL)
+        utils_fatal_error("arena: out of memory: ");
+    c->size = size;
+    c->used = 0;
+    c->next = NULL;
+    return c;
+}
+
+struct arena *
+arena_create(void)
+{
+    /* Place the arena header at the start of its own first chunk */
+    struct arena_chunk *c = chunk_create(ARENA_FIRST_CHUNK);
+    struct arena *arena = (struct arena *) c->data;
+    c->used = (sizeof *arena + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    arena->chunks = c;
+    arena->refs = 1;
+    return arena;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    struct arena_chunk *c = arena->chunks;
+    if (c->size - c->used < size) {
+        size_t newsize = 2 * c->size;
+        while (newsize < size)
+            newsize *= 2;
+
+        struct arena_chunk *n = chunk_create(newsize);
+        n->next = c;
+        arena->chunks = c = n;
+    }
+
+    void *p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+void *
+arena_calloc(struct arena *arena, size_t size)
+{
+    return memset(arena_alloc(arena, size), 0, size);
+}
+
+char *
+arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+    char *p = arena_alloc(arena, n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+char *
+arena_strdup(struct arena *arena, const char *s)
+{
+    return arena_strndup(arena, s, strlen(s));
+}
+
+struct arena *
+arena_retain(struct arena *arena)
+{
+    arena->refs++;
+    return arena;
+}
+
+void
+arena_release(struct arena *arena)
+{
+    assert(arena->refs > 0);
+    if (--arena->refs == 0)
+        arena_destroy(arena);
+}
+
+void
+arena_destroy(struct arena *arena)
+{
+    /* The first chunk, which holds the arena itself, is last in the list */
+    struct arena_chunk *c = arena->chunks;
+    while (c != NULL) {
+        struct arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef __ARENA_H
+#define __ARENA_H
+
+#include <stddef.h>
+
+/* An arena hands out memory that is released all at once.
+ * The parser allocates everything belonging to one command line
+ * from a single arena.  Arenas are reference counted so that
+ * pipelines that outlive their command line as jobs keep the
+ * memory they point into alive. */
+struct arena;
+
+/* Create an arena with a reference count of 1 */
+struct arena * arena_create(void);
+
+/* Allocate 'size' bytes, suitably aligned for any type */
+void * arena_alloc(struct arena *arena, size_t size);
+
+/* Allocate zero-filled memory */
+void * arena_calloc(struct arena *arena, size_t size);
+
+/* Copy a string, or its first 'n' characters, into the arena */
+char * arena_strdup(struct arena *arena, const char *s);
+char * arena_strndup(struct arena *arena, const char *s, size_t n);
+
+/* Add a reference */
+struct arena * arena_retain(struct arena *arena);
+
+/* Drop a reference; the arena is destroyed when the last one goes */
+void arena_release(struct arena *arena);
+
+/* Free all memory of the arena regardless of outstanding references */
+void arena_destroy(struct arena *arena);
+
+#endif /* __ARENA_H */
@@ -0,0 +1,46 @@
+/*
+ * The registry of builtin commands.
+ *
+ * builtin_hash.h is generated by mkbuiltins from builtins.def.  It
+ * picks a seed for builtin_name_hash() and a table size under which the
+ * names in builtins.def all land in different slots.  A lookup then
+ * needs no probing: it hashes the name, looks at one slot, and
+ * compares one string, however many builtins there are.
+ */
+
+#include <string.h>
+
+#include "builtin_table.h"
+#include "builtin_hash.h"
+#include "utils.h"
+
+static struct builtin table[BUILTIN_HASH_SIZE];
+
+static struct builtin *
+slot(const char *name)
+{
+    uint32_t h = builtin_name_hash(name, BUILTIN_HASH_SEED);
+    return &table[h & (BUILTIN_HASH_SIZE - 1)];
+}
+
+void
+builtin_register(const char *name, builtin_fn run, unsigned caps)
+{
+    struct builtin *b = slot(name);
+    if (b->name != NULL && strcmp(b->name, name) != 0)
+        utils_fatal_error("builtin %s collides with %s, "
+                          "add it to builtins.def: ", name, b->name);
+
+    if ((caps & BUILTIN_PIPELINE) && (caps & BUILTIN_TERMINAL))
+        utils_fatal_error("builtin %s cannot run in a child "
+                          "if it needs the terminal: ", name);
+
+    *b = (struct builtin) { .name = name, .run = run, .caps = caps };
+}
+
+const struct builtin *
+builtin_lookup(const char *name)
+{
+    struct builtin *b = slot(name);
+    return b->name != NULL && strcmp(b->name, name) == 0 ? b : NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef __BUILTIN_TABLE_H
+#define __BUILTIN_TABLE_H
+
+#include <stdint.h>
+
+/* The registry of builtin commands.  Each builtin is registered once
+ * with its name, the function that runs it and what it may do.  The
+ * names of the shell's builtins are listed in builtins.def, from which
+ * the build generates a hash function that maps each of them to a
+ * slot of its own, so a lookup costs one hash and one comparison. */
+
+/* What a builtin may do, and so how run_command schedules it */
+enum builtin_caps {
+    /* Its effect is its output, so it can run in a child of the shell:
+     * as a stage of a pipeline, or as a background job.  Builtins
+     * without it change the shell's state and run in the shell. */
+    BUILTIN_PIPELINE = 1 << 0,
+    /* It may hand the terminal to a job and wait for it, so it only
+     * runs in the shell, and the shell takes the terminal back when it
+     * returns.  It cannot have BUILTIN_PIPELINE. */
+    BUILTIN_TERMINAL = 1 << 1,
+    /* Its stdin, stdout and stderr may be redirected while it runs */
+    BUILTIN_REDIRECT = 1 << 2,
+};
+
+/* Run the builtin; argv[0] is its name.  Returns its exit status. */
+typedef int (*builtin_fn)(char **argv);
+
+struct builtin {
+    const char *name;
+    builtin_fn run;
+    unsigned caps;              /* enum builtin_caps */
+};
+
+/* Make 'name' a builtin.  'name' must stay valid.  Names that are not
+ * in builtins.def may collide with another builtin's slot, which is
+ * a fatal error. */
+void builtin_register(const char *name, builtin_fn run, unsigned caps);
+
+/* Return the builtin called 'name', or NULL */
+const struct builtin * builtin_lookup(const char *name);
+
+/* Seeded FNV-1a, shared with the generator of the hash parameters */
+static inline uint32_t
+builtin_name_hash(const char *name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ seed;
+    while (*name)
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    return h ^ (h >> 16);
+}
+
+#endif /* __BUILTIN_TABLE_H */
@@ -0,0 +1,87 @@
+/*
+ * A lock-free ring of child status changes.
+ *
+ * Reaping a child and updating the job it belongs to are separate
+ * steps.  The producer only calls wait4 and fills in a slot, which
+ * keeps it async-signal-safe; the consumer does everything that
+ * prints, allocates or touches the job list.  A burst of exits, such
+ * as a long pipeline finishing, is reaped in one go and then handled
+ * in a single pass.
+ *
+ * head is only written by the consumer and tail only by the producer.
+ * Each side publishes its index with a release store after it is done
+ * with the slot, and reads the other side's index with an acquire
+ * load, so neither can see a slot the other is still using.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "child_ring.h"
+
+#define CHILD_RING_SIZE 4096    /* Must be a power of two */
+
+static struct child_event ring[CHILD_RING_SIZE];
+static atomic_uint head;        /* Next record to pop */
+static atomic_uint tail;        /* Next slot to fill */
+
+int
+child_ring_reap(pid_t pid, int options)
+{
+    int saved_errno = errno;
+    unsigned t = atomic_load_explicit(&tail, memory_order_relaxed);
+    int n = 0;
+
+    while (t - atomic_load_explicit(&head, memory_order_acquire) < CHILD_RING_SIZE) {
+        struct rusage ru;
+        int status;
+        pid_t child = wait4(pid, &status, options, &ru);
+        if (child == -1 && n == 0)
+            return -1;
+        if (child <= 0)
+            break;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        ring[t & (CHILD_RING_SIZE - 1)] = (struct child_event) {
+            .pid = child,
+            .status = status,
+            .usage = {
+                .utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+                .stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+                .maxrss = ru.ru_maxrss,
+                .nvcsw = ru.ru_nvcsw,
+                .nivcsw = ru.ru_nivcsw,
+            },
+            .reaped_ns = now.tv_sec * 1000000000LL + now.tv_nsec,
+        };
+        atomic_store_explicit(&tail, ++t, memory_order_release);
+        options |= WNOHANG;
+        n++;
+    }
+    errno = saved_errno;
+    return n;
+}
+
+bool
+child_ring_pop(struct child_event *ev)
+{
+    unsigned h = atomic_load_explicit(&head, memory_order_relaxed);
+    if (h == atomic_load_explicit(&tail, memory_order_acquire))
+        return false;
+
+    *ev = ring[h & (CHILD_RING_SIZE - 1)];
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+    return true;
+}
+
+bool
+child_ring_pending(void)
+{
+    return atomic_load_explicit(&head, memory_order_relaxed)
+        != atomic_load_explicit(&tail, memory_order_acquire);
+}
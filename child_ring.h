@@ -0,0 +1,36 @@
+#ifndef __CHILD_RING_H
+#define __CHILD_RING_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+
+#include "proc_usage.h"
+
+/* A single-producer, single-consumer ring of child status changes.
+ * The producer reaps children and records what happened to them; the
+ * consumer updates the job list from the records later, in batches.
+ * The producer only calls wait4 and stores into the ring, so it may
+ * run in a signal handler or in another thread than the consumer. */
+
+/* What wait4 reported for one child */
+struct child_event {
+    pid_t pid;
+    int status;                 /* As for the WIF...() macros */
+    struct proc_usage usage;    /* Valid once the child terminated */
+    long long reaped_ns;        /* CLOCK_MONOTONIC time it was reaped */
+};
+
+/* Producer: reap children as wait4(pid, ..., options) selects them
+ * and push a record for each, until there are no more or the ring is
+ * full.  The first wait4 may block unless options has WNOHANG; the
+ * rest do not.  Returns the number of records pushed, or -1 with
+ * errno set if the first wait4 failed.  Async-signal-safe. */
+int child_ring_reap(pid_t pid, int options);
+
+/* Consumer: take the oldest record.  Returns false if there is none. */
+bool child_ring_pop(struct child_event *ev);
+
+/* Consumer: true if there are records to take */
+bool child_ring_pending(void);
+
+#endif /* __CHILD_RING_H */
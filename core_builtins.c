@@ -0,0 +1,630 @@
+/*
+ * Utilities the shell runs itself: echo, printf, test and [, and pwd.
+ *
+ * Spawning /bin/echo or /usr/bin/test costs far more than what the
+ * command does, so scripts that run many of them spend most of their
+ * time creating processes.  These versions follow POSIX and the
+ * coreutils behavior scripts commonly rely on, such as echo -n and -e.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "core_builtins.h"
+
+/* Write the character the escape sequence at 's', which follows a
+ * backslash, stands for to 'out', and return what follows it.  In echo
+ * and %b arguments octal escapes are written \0nnn, in printf formats
+ * \nnn.  Sets *stop at \c, after which no output must follow. */
+static const char *
+put_escape(FILE *out, const char *s, bool zero_octal, bool *stop)
+{
+    int c, n;
+
+    switch (*s) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'e': c = 033; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': c = '\\'; break;
+    case 'c':
+        *stop = true;
+        return s + 1;
+    case 'x':
+        if (!isxdigit((unsigned char) s[1]))
+            goto literal;
+        c = 0;
+        for (n = 0, s++; n < 2 && isxdigit((unsigned char) *s); n++, s++)
+            c = 16 * c + (isdigit((unsigned char) *s) ? *s - '0'
+                                                      : tolower(*s) - 'a' + 10);
+        fputc(c, out);
+        return s;
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+        if (zero_octal) {
+            if (*s != '0')
+                goto literal;
+            s++;
+        }
+        c = 0;
+        for (n = 0; n < 3 && *s >= '0' && *s <= '7'; n++, s++)
+            c = 8 * c + *s - '0';
+        fputc(c, out);
+        return s;
+    case '\0':
+        fputc('\\', out);
+        return s;
+    default:
+    literal:
+        fputc('\\', out);
+        fputc(*s, out);
+        return s + 1;
+    }
+    fputc(c, out);
+    return s + 1;
+}
+
+/* Write 's' to 'out' with its escape sequences replaced */
+static void
+put_escaped(FILE *out, const char *s, bool zero_octal, bool *stop)
+{
+    while (*s && !*stop) {
+        if (*s == '\\')
+            s = put_escape(out, s + 1, zero_octal, stop);
+        else
+            fputc(*s++, out);
+    }
+}
+
+/* Write 's' to 'out' quoted so that a shell would read it back as is */
+static void
+put_quoted(FILE *out, const char *s)
+{
+    if (*s != '\0' && strspn(s, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                 "0123456789_-+=,./:@%^") == strlen(s)) {
+        fputs(s, out);
+        return;
+    }
+    fputc('\'', out);
+    for (; *s; s++) {
+        if (*s == '\'')
+            fputs("'\\''", out);
+        else
+            fputc(*s, out);
+    }
+    fputc('\'', out);
+}
+
+int
+builtin_echo(char **argv)
+{
+    bool newline = true, escapes = false, stop = false;
+    char **arg = argv + 1;
+
+    /* Only arguments made up of the option letters are options */
+    for (; *arg != NULL && (*arg)[0] == '-' && (*arg)[1] != '\0'; arg++) {
+        if (strspn(*arg + 1, "neE") != strlen(*arg + 1))
+            break;
+        for (const char *o = *arg + 1; *o; o++) {
+            if (*o == 'n')
+                newline = false;
+            else
+                escapes = *o == 'e';
+        }
+    }
+
+    for (bool first = true; *arg != NULL && !stop; arg++, first = false) {
+        if (!first)
+            putchar(' ');
+        if (escapes)
+            put_escaped(stdout, *arg, true, &stop);
+        else
+            fputs(*arg, stdout);
+    }
+    if (newline && !stop)
+        putchar('\n');
+    return 0;
+}
+
+/* Complain if strto*() did not convert all of 'arg', which ends at
+ * 'end', or if it was out of range. */
+static void
+check_number(const char *arg, char **end, int *status)
+{
+    if (**end != '\0') {
+        fprintf(stderr, "printf: %s: %s\n", arg,
+                *end == arg ? "expected a numeric value"
+                            : "value not completely converted");
+        *status = 1;
+    } else if (errno == ERANGE) {
+        fprintf(stderr, "printf: %s: %s\n", arg, strerror(ERANGE));
+        *status = 1;
+    }
+}
+
+/* The value of a numeric printf argument, 0 if it is missing.  A
+ * leading quote stands for the code of the character after it. */
+static long long
+signed_arg(const char *arg, int *status)
+{
+    if (arg == NULL)
+        return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char) arg[1];
+
+    char *end;
+    errno = 0;
+    long long v = strtoll(arg, &end, 0);
+    check_number(arg, &end, status);
+    return v;
+}
+
+static unsigned long long
+unsigned_arg(const char *arg, int *status)
+{
+    if (arg == NULL)
+        return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char) arg[1];
+
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 0);
+    check_number(arg, &end, status);
+    return v;
+}
+
+static double
+double_arg(const char *arg, int *status)
+{
+    if (arg == NULL)
+        return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char) arg[1];
+
+    char *end;
+    errno = 0;
+    double v = strtod(arg, &end);
+    check_number(arg, &end, status);
+    return v;
+}
+
+int
+builtin_printf(char **argv)
+{
+    if (argv[1] == NULL) {
+        fprintf(stderr, "printf: missing operand\n");
+        return 1;
+    }
+
+    const char *format = argv[1];
+    char **args = argv + 2;
+    int status = 0;
+    bool stop = false;
+
+    /* The format is reused as long as it consumes arguments */
+    for (;;) {
+        char **first_arg = args;
+        for (const char *p = format; *p && !stop; ) {
+            if (*p == '\\') {
+                p = put_escape(stdout, p + 1, false, &stop);
+                continue;
+            }
+            if (*p != '%') {
+                putchar(*p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                putchar('%');
+                p += 2;
+                continue;
+            }
+
+            /* Copy the conversion specification, with any '*' replaced
+             * by the argument it stands for */
+            char spec[64];
+            size_t len = 0;
+            spec[len++] = *p++;
+            while (*p && strchr("-+ #0'", *p) && len < 16)
+                spec[len++] = *p++;
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (*p != '.')
+                        break;
+                    spec[len++] = *p++;
+                }
+                if (*p == '*') {
+                    int n = signed_arg(*args, &status);
+                    if (*args != NULL)
+                        args++;
+                    len += snprintf(spec + len, 16, "%d", n);
+                    p++;
+                } else {
+                    while (isdigit((unsigned char) *p) && len < 48)
+                        spec[len++] = *p++;
+                }
+            }
+            /* Length modifiers make no difference here */
+            while (*p && strchr("hlLjzt", *p))
+                p++;
+
+            char conv = *p;
+            if (conv == '\0' || !strchr("diouxXeEfFgGaAcsbq", conv)) {
+                if (conv == '\0')
+                    fprintf(stderr, "printf: %%: missing format character\n");
+                else
+                    fprintf(stderr, "printf: %%%c: invalid conversion specification\n", conv);
+                return 1;
+            }
+            p++;
+
+            const char *arg = *args;
+            if (arg != NULL)
+                args++;
+
+            switch (conv) {
+            case 'd': case 'i':
+                strcpy(spec + len, "ll");
+                spec[len + 2] = conv;
+                spec[len + 3] = '\0';
+                printf(spec, signed_arg(arg, &status));
+                break;
+            case 'o': case 'u': case 'x': case 'X':
+                strcpy(spec + len, "ll");
+                spec[len + 2] = conv;
+                spec[len + 3] = '\0';
+                printf(spec, unsigned_arg(arg, &status));
+                break;
+            case 'e': case 'E': case 'f': case 'F':
+            case 'g': case 'G': case 'a': case 'A':
+                spec[len] = conv;
+                spec[len + 1] = '\0';
+                printf(spec, double_arg(arg, &status));
+                break;
+            case 'c': {
+                /* %s keeps the width, and prints nothing for "" */
+                char c[2] = { arg != NULL ? arg[0] : '\0', '\0' };
+                spec[len] = 's';
+                spec[len + 1] = '\0';
+                printf(spec, c);
+                break;
+            }
+            case 's':
+                spec[len] = 's';
+                spec[len + 1] = '\0';
+                printf(spec, arg != NULL ? arg : "");
+                break;
+            case 'b':
+            case 'q': {
+                char *buf = NULL;
+                size_t size = 0;
+                FILE *expanded = open_memstream(&buf, &size);
+                if (expanded == NULL) {
+                    perror("printf");
+                    return 1;
+                }
+                if (conv == 'b')
+                    put_escaped(expanded, arg != NULL ? arg : "", true, &stop);
+                else
+                    put_quoted(expanded, arg != NULL ? arg : "");
+                fclose(expanded);
+                spec[len] = 's';
+                spec[len + 1] = '\0';
+                printf(spec, buf);
+                free(buf);
+                break;
+            }
+            }
+        }
+        if (stop || *args == NULL || args == first_arg)
+            break;
+    }
+    return status;
+}
+
+/* State of the parser for test expressions of more than four
+ * arguments */
+struct test_parser {
+    char **args;
+    int nargs;
+    int pos;
+    bool error;         /* the expression is malformed */
+    bool bad_number;    /* an integer operand was not a number */
+};
+
+static bool
+is_unary_op(const char *op)
+{
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0'
+           && strchr("bcdefghLnprsStuwxz", op[1]) != NULL;
+}
+
+static bool
+is_binary_op(const char *op)
+{
+    static const char *ops[] = {
+        "=", "!=", "-eq", "-ne", "-gt", "-ge", "-lt", "-le",
+        "-nt", "-ot", "-ef", NULL
+    };
+    for (const char **o = ops; *o != NULL; o++)
+        if (strcmp(op, *o) == 0)
+            return true;
+    return false;
+}
+
+/* Parse an integer operand, allowing surrounding blanks */
+static bool
+test_integer(const char *s, long long *v)
+{
+    char *end;
+    errno = 0;
+    *v = strtoll(s, &end, 10);
+    while (isspace((unsigned char) *end))
+        end++;
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        return false;
+    }
+    return true;
+}
+
+static bool
+test_unary(const char *op, const char *arg)
+{
+    struct stat st;
+
+    switch (op[1]) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 't': return isatty(atoi(arg));
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h':
+    case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if (stat(arg, &st) != 0)
+        return false;
+    switch (op[1]) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    }
+    return false;
+}
+
+static bool
+newer(const struct stat *a, const struct stat *b)
+{
+    return a->st_mtim.tv_sec > b->st_mtim.tv_sec
+           || (a->st_mtim.tv_sec == b->st_mtim.tv_sec
+               && a->st_mtim.tv_nsec > b->st_mtim.tv_nsec);
+}
+
+static bool
+test_binary(const char *left, const char *op, const char *right, bool *error)
+{
+    if (strcmp(op, "=") == 0)
+        return strcmp(left, right) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(left, right) != 0;
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0
+        || strcmp(op, "-ef") == 0) {
+        struct stat l, r;
+        bool lok = stat(left, &l) == 0, rok = stat(right, &r) == 0;
+        if (op[1] == 'e')
+            return lok && rok && l.st_dev == r.st_dev && l.st_ino == r.st_ino;
+        /* A file that exists is newer than one that does not */
+        if (op[1] == 'n')
+            return lok && (!rok || newer(&l, &r));
+        return rok && (!lok || newer(&r, &l));
+    }
+
+    long long l, r;
+    if (!test_integer(left, &l) || !test_integer(right, &r)) {
+        *error = true;
+        return false;
+    }
+    if (strcmp(op, "-eq") == 0) return l == r;
+    if (strcmp(op, "-ne") == 0) return l != r;
+    if (strcmp(op, "-gt") == 0) return l > r;
+    if (strcmp(op, "-ge") == 0) return l >= r;
+    if (strcmp(op, "-lt") == 0) return l < r;
+    return l <= r;
+}
+
+static bool test_or(struct test_parser *tp);
+
+static const char *
+test_peek(struct test_parser *tp, int ahead)
+{
+    return tp->pos + ahead < tp->nargs ? tp->args[tp->pos + ahead] : NULL;
+}
+
+/* primary: ( expr ) | unary-op arg | arg binary-op arg | arg */
+static bool
+test_primary(struct test_parser *tp)
+{
+    const char *a = test_peek(tp, 0), *b = test_peek(tp, 1);
+    const char *c = test_peek(tp, 2);
+
+    if (a == NULL) {
+        tp->error = true;
+        return false;
+    }
+    if (b != NULL && c != NULL && is_binary_op(b)) {
+        tp->pos += 3;
+        return test_binary(a, b, c, &tp->bad_number);
+    }
+    if (strcmp(a, "(") == 0) {
+        tp->pos++;
+        bool v = test_or(tp);
+        const char *close = test_peek(tp, 0);
+        if (close == NULL || strcmp(close, ")") != 0)
+            tp->error = true;
+        tp->pos++;
+        return v;
+    }
+    if (b != NULL && is_unary_op(a)) {
+        tp->pos += 2;
+        return test_unary(a, b);
+    }
+    tp->pos++;
+    return a[0] != '\0';
+}
+
+static bool
+test_not(struct test_parser *tp)
+{
+    const char *a = test_peek(tp, 0);
+    if (a != NULL && strcmp(a, "!") == 0 && test_peek(tp, 1) != NULL) {
+        tp->pos++;
+        return !test_not(tp);
+    }
+    return test_primary(tp);
+}
+
+static bool
+test_and(struct test_parser *tp)
+{
+    bool v = test_not(tp);
+    while (test_peek(tp, 0) && strcmp(test_peek(tp, 0), "-a") == 0) {
+        tp->pos++;
+        v = test_not(tp) && v;
+    }
+    return v;
+}
+
+static bool
+test_or(struct test_parser *tp)
+{
+    bool v = test_and(tp);
+    while (test_peek(tp, 0) && strcmp(test_peek(tp, 0), "-o") == 0) {
+        tp->pos++;
+        v = test_and(tp) || v;
+    }
+    return v;
+}
+
+/* Evaluate the 'n' arguments of test as POSIX specifies for up to
+ * four arguments, and with the usual precedence of !, -a and -o
+ * beyond that.  Returns the exit status. */
+static int
+test_eval(char **args, int n)
+{
+    bool error = false, v;
+
+    switch (n) {
+    case 0:
+        return 1;
+    case 1:
+        return args[0][0] == '\0';
+    case 2:
+        if (strcmp(args[0], "!") == 0)
+            return args[1][0] != '\0';
+        if (is_unary_op(args[0]))
+            return !test_unary(args[0], args[1]);
+        fprintf(stderr, "test: %s: unary operator expected\n", args[0]);
+        return 2;
+    case 3:
+        if (is_binary_op(args[1])) {
+            v = test_binary(args[0], args[1], args[2], &error);
+            return error ? 2 : !v;
+        }
+        if (strcmp(args[0], "!") == 0) {
+            int status = test_eval(args + 1, 2);
+            return status == 2 ? 2 : !status;
+        }
+        if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0)
+            return test_eval(args + 1, 1);
+        break;
+    case 4:
+        if (strcmp(args[0], "!") == 0) {
+            int status = test_eval(args + 1, 3);
+            return status == 2 ? 2 : !status;
+        }
+        if (strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0)
+            return test_eval(args + 1, 2);
+        break;
+    }
+
+    struct test_parser tp = { .args = args, .nargs = n };
+    v = test_or(&tp);
+    if (tp.bad_number)
+        return 2;
+    if (tp.error || tp.pos != n) {
+        fprintf(stderr, "test: syntax error\n");
+        return 2;
+    }
+    return !v;
+}
+
+int
+builtin_test(char **argv)
+{
+    int n = 0;
+    while (argv[n + 1] != NULL)
+        n++;
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (n == 0 || strcmp(argv[n], "]") != 0) {
+            fprintf(stderr, "[: missing ']'\n");
+            return 2;
+        }
+        n--;
+    }
+    return test_eval(argv + 1, n);
+}
+
+int
+builtin_true(char **argv)
+{
+    return 0;
+}
+
+int
+builtin_false(char **argv)
+{
+    return 1;
+}
+
+int
+builtin_pwd(char **argv)
+{
+    /* The shell does not maintain $PWD, so -L and -P are the same */
+    for (char **arg = argv + 1; *arg != NULL; arg++) {
+        if (strcmp(*arg, "-L") != 0 && strcmp(*arg, "-P") != 0) {
+            fprintf(stderr, "pwd: %s: invalid option\n", *arg);
+            return 1;
+        }
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        perror("pwd");
+        return 1;
+    }
+    puts(cwd);
+    free(cwd);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef __CORE_BUILTINS_H
+#define __CORE_BUILTINS_H
+
+/* Utilities the shell runs itself instead of spawning them.  Each
+ * takes the command's argv, writes to stdout and stderr like the
+ * external command would, and returns the exit status it would
+ * have exited with. */
+
+/* echo [-neE] [string...] */
+int builtin_echo(char **argv);
+
+/* printf format [argument...] */
+int builtin_printf(char **argv);
+
+/* test expression, and [ expression ] */
+int builtin_test(char **argv);
+
+/* true and false */
+int builtin_true(char **argv);
+int builtin_false(char **argv);
+
+/* pwd [-LP] */
+int builtin_pwd(char **argv);
+
+#endif /* __CORE_BUILTINS_H */
@@ -0,0 +1,840 @@
+/*
+ * cush-bench - micro benchmarks for the data structures and
+ * system call paths the shell relies on.
+ *
+ * Usage: cush-bench <benchmark> [args]
+ * Run without arguments for a list of benchmarks.
+ */
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+
+#include "pid_index.h"
+#include "jid_allocator.h"
+#include "shell-ast.h"
+#include "script_parser.h"
+#include "builtin_table.h"
+#include "signal_support.h"
+#include "utils.h"
+#include "dir_cache.h"
+#include "glob_expand.h"
+
+extern char **environ;
+
+/* Count calls into the allocator by interposing on malloc & co. */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+static long malloc_calls;
+
+void *
+malloc(size_t size)
+{
+    malloc_calls++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    malloc_calls++;
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    malloc_calls++;
+    return __libc_realloc(ptr, size);
+}
+
+/* Monotonic clock in nanoseconds */
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * Spawn 'n' short background children, then reap them all and
+ * measure the bookkeeping cost per reaped child: once through the
+ * pid index, and once through the linear job scan the shell used
+ * before.
+ */
+static int
+bench_reap(int ac, char *av[])
+{
+    int n = ac > 1 ? atoi(av[1]) : 10000;
+    pid_t *pids = calloc(n, sizeof *pids);
+    char *argv[] = { "true", NULL };
+
+    signal_block(SIGCHLD);
+    long long t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        if (posix_spawnp(&pids[i], argv[0], NULL, NULL, argv, environ) != 0)
+            utils_fatal_error("posix_spawnp failed: ");
+        pid_index_insert(pids[i], &pids[i], 0);
+    }
+    long long spawned = now_ns();
+
+    long long index_ns = 0, index_max = 0, scan_ns = 0, scan_max = 0;
+    int reaped = 0;
+    pid_t child;
+    while ((child = waitpid(-1, NULL, 0)) > 0) {
+        long long s = now_ns();
+        struct pid_index_entry *ent = pid_index_lookup(child);
+        if (ent == NULL)
+            utils_fatal_error("pid %d missing from index", child);
+        pid_index_remove(child);
+        long long d = now_ns() - s;
+        index_ns += d;
+        if (d > index_max)
+            index_max = d;
+
+        /* what handle_child_status used to do */
+        s = now_ns();
+        volatile int found = -1;
+        for (int i = 0; i < n; i++)
+            if (pids[i] == child)
+                found = i;
+        d = now_ns() - s;
+        (void) found;
+        scan_ns += d;
+        if (d > scan_max)
+            scan_max = d;
+        reaped++;
+    }
+    long long done = now_ns();
+
+    printf("spawned %d jobs in %.1f ms, reaped in %.1f ms\n",
+           n, (spawned - t0) / 1e6, (done - spawned) / 1e6);
+    printf("per-child lookup  pid index: mean %6.0f ns  max %8lld ns\n",
+           (double) index_ns / reaped, index_max);
+    printf("per-child lookup  job scan:  mean %6.0f ns  max %8lld ns\n",
+           (double) scan_ns / reaped, scan_max);
+    free(pids);
+    return 0;
+}
+
+/*
+ * Job churn: keep 'live' jobs around and repeatedly delete a random
+ * one and create a new one.  Compares the jid allocator against
+ * scanning the job table for the lowest free slot.
+ */
+static int
+bench_jid(int ac, char *av[])
+{
+    int live = ac > 1 ? atoi(av[1]) : 10000;
+    int ops = ac > 2 ? atoi(av[2]) : 1000000;
+    if (live <= 0 || live >= JID_LIMIT) {
+        fprintf(stderr, "live jobs must be in [1, %d)\n", JID_LIMIT);
+        return EXIT_FAILURE;
+    }
+
+    int *jids = calloc(live, sizeof *jids);
+    static char used[JID_LIMIT];
+
+    for (int i = 0; i < live; i++)
+        used[jids[i] = jid_alloc()] = 1;
+
+    srandom(42);
+    long long t0 = now_ns();
+    for (int i = 0; i < ops; i++) {
+        int victim = random() % live;
+        jid_free(jids[victim]);
+        jids[victim] = jid_alloc();
+    }
+    long long alloc_ns = now_ns() - t0;
+
+    srandom(42);
+    t0 = now_ns();
+    for (int i = 0; i < ops; i++) {
+        int victim = random() % live;
+        used[jids[victim]] = 0;
+        int j = 1;
+        while (used[j])
+            j++;
+        used[j] = 1;
+        jids[victim] = j;
+    }
+    long long scan_ns = now_ns() - t0;
+
+    printf("%d create/delete pairs with %d live jobs\n", ops, live);
+    printf("jid allocator: %6.1f ns/op\n", (double) alloc_ns / ops);
+    printf("table scan:    %6.1f ns/op\n", (double) scan_ns / ops);
+    free(jids);
+    return 0;
+}
+
+static int
+cmp_ll(const void *a, const void *b)
+{
+    long long x = *(const long long *) a, y = *(const long long *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Spawn /bin/true 'n' times, one child at a time, and print
+ * percentiles of the time posix_spawn takes.  posix_spawn returns
+ * once the child has exec'ed, so this is spawn-to-exec latency.
+ */
+static void
+spawn_latency(const char *name, int n)
+{
+    char *argv[] = { "/bin/true", NULL };
+    long long *lat = malloc(n * sizeof *lat);
+    long long t0 = now_ns();
+    for (int i = 0; i < n; i++) {
+        pid_t pid;
+        long long s = now_ns();
+        if (posix_spawn(&pid, argv[0], NULL, NULL, argv, environ) != 0)
+            utils_fatal_error("posix_spawn failed: ");
+        lat[i] = now_ns() - s;
+        waitpid(pid, NULL, 0);
+    }
+    double secs = (now_ns() - t0) / 1e9;
+
+    qsort(lat, n, sizeof *lat, cmp_ll);
+    long long sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += lat[i];
+    printf("%-14s mean %7.1f us  p50 %7.1f us  p99 %7.1f us  %8.0f spawns/s\n",
+           name, sum / 1e3 / n, lat[n / 2] / 1e3, lat[n * 99 / 100] / 1e3,
+           n / secs);
+    free(lat);
+}
+
+/*
+ * Spawn latency of each spawn backend, and of clone-vfork without the
+ * stack pool.  With 'rss_mb', first grow the benchmark's resident set
+ * by that many MB: fork has to copy the page tables, the others do not.
+ */
+static int
+bench_spawn(int ac, char *av[])
+{
+    static const char *backends[] = { "clone-vfork", "vfork", "fork", "clone3" };
+    int n = ac > 1 ? atoi(av[1]) : 100000;
+    size_t rss = ac > 2 ? atol(av[2]) << 20 : 0;
+
+    char *ballast = NULL;
+    if (rss > 0) {
+        ballast = malloc(rss);
+        if (ballast == NULL)
+            utils_fatal_error("malloc failed: ");
+        memset(ballast, 1, rss);
+    }
+
+    printf("%d spawns each, %zu MB resident ballast\n", n, rss >> 20);
+    for (int i = 0; i < sizeof backends / sizeof backends[0]; i++) {
+        if (posix_spawn_backend_np(backends[i]) != 0)
+            utils_fatal_error("unknown spawn backend %s", backends[i]);
+        spawn_latency(backends[i], n);
+    }
+
+    posix_spawn_backend_np("clone-vfork");
+    posix_spawn_stack_pool_np(0);
+    spawn_latency("no stack pool", n);
+    posix_spawn_stack_pool_np(1);
+
+    free(ballast);
+    return 0;
+}
+
+/*
+ * Start an n-stage pipeline of /bin/cat the way run_command used to:
+ * attributes, file actions and a pipe created for each stage on its
+ * own.  Stores the pids in 'pids'.
+ */
+static void
+pipeline_per_stage(int n, pid_t *pids)
+{
+    char *argv[] = { "cat", NULL };
+    int prev_read = -1;
+    for (int i = 0; i < n; i++) {
+        int fd[2] = { -1, -1 };
+        posix_spawn_file_actions_t fa;
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        posix_spawn_file_actions_init(&fa);
+
+        if (i == 0)
+            posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        if (i == n - 1)
+            posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        if (prev_read != -1)
+            posix_spawn_file_actions_adddup2(&fa, prev_read, STDIN_FILENO);
+        if (i != n - 1) {
+            if (pipe2(fd, O_CLOEXEC) == -1)
+                utils_fatal_error("pipe2 failed: ");
+            posix_spawn_file_actions_adddup2(&fa, fd[1], STDOUT_FILENO);
+        }
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, i == 0 ? 0 : pids[0]);
+
+        int pidfd;
+        if (posix_spawnp_pidfd_np(&pids[i], &pidfd, argv[0], &fa, &attr, argv, environ) != 0)
+            utils_fatal_error("posix_spawnp failed: ");
+        close(pidfd);
+        posix_spawn_file_actions_destroy(&fa);
+        posix_spawnattr_destroy(&attr);
+
+        if (prev_read != -1)
+            close(prev_read);
+        if (fd[1] != -1)
+            close(fd[1]);
+        prev_read = fd[0];
+    }
+}
+
+/* The same pipeline, started with posix_spawn_pipeline_np */
+static void
+pipeline_batch(int n, pid_t *pids)
+{
+    static char *argv[] = { "cat", NULL };
+    posix_spawn_stage_t stages[n];
+    posix_spawn_file_actions_t first, last;
+    posix_spawn_file_actions_init(&first);
+    posix_spawn_file_actions_init(&last);
+    posix_spawn_file_actions_addopen(&first, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&last, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    for (int i = 0; i < n; i++)
+        stages[i] = (posix_spawn_stage_t) {
+            .file = argv[0], .argv = argv, .use_path = 1,
+            .file_actions = i == n - 1 ? &last : i == 0 ? &first : NULL,
+        };
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    if (posix_spawn_pipeline_np(stages, n, &attr, environ) != 0)
+        utils_fatal_error("posix_spawn_pipeline_np failed: ");
+
+    for (int i = 0; i < n; i++) {
+        if (stages[i].error != 0)
+            utils_fatal_error("stage %d failed: %s", i, strerror(stages[i].error));
+        pids[i] = stages[i].pid;
+        close(stages[i].pidfd);
+    }
+    posix_spawn_file_actions_destroy(&first);
+    posix_spawn_file_actions_destroy(&last);
+    posix_spawnattr_destroy(&attr);
+}
+
+/* Time 'runs' starts of an n-stage pipeline with 'start' */
+static void
+pipeline_latency(const char *name, void (*start)(int, pid_t *), int n, int runs)
+{
+    pid_t *pids = malloc(n * sizeof *pids);
+    long long *started = malloc(runs * sizeof *started);
+    long long *done = malloc(runs * sizeof *done);
+    long calls = 0;
+
+    for (int r = 0; r < runs; r++) {
+        long long t0 = now_ns();
+        long before = malloc_calls;
+        start(n, pids);
+        calls += malloc_calls - before;
+        started[r] = now_ns() - t0;
+        for (int i = 0; i < n; i++)
+            waitpid(pids[i], NULL, 0);
+        done[r] = now_ns() - t0;
+    }
+
+    qsort(started, runs, sizeof *started, cmp_ll);
+    qsort(done, runs, sizeof *done, cmp_ll);
+    printf("%-10s started p50 %8.1f us p99 %8.1f us  "
+           "exited p50 %8.1f us  %5.1f mallocs/stage\n",
+           name, started[runs / 2] / 1e3, started[runs * 99 / 100] / 1e3,
+           done[runs / 2] / 1e3, (double) calls / runs / n);
+    free(pids);
+    free(started);
+    free(done);
+}
+
+/* Starting pipelines stage by stage versus with one batch call */
+static int
+bench_pipeline(int ac, char *av[])
+{
+    int n = ac > 1 ? atoi(av[1]) : 8;
+    int runs = ac > 2 ? atoi(av[2]) : 1000;
+
+    printf("%d runs of a %d-stage pipeline\n", runs, n);
+    pipeline_latency("per-stage", pipeline_per_stage, n, runs);
+    pipeline_latency("batch", pipeline_batch, n, runs);
+    return 0;
+}
+
+/* Command lines typical of interactive use */
+static const char *parse_corpus[] = {
+    "ls -l",
+    "cd /tmp",
+    "make -j8 all > build.log",
+    "grep -r foo src | sort | uniq -c | sort -rn | head -20",
+    "sleep 10 &",
+    "cat < input.txt | tr a-z A-Z >> output.txt",
+    "gcc -Wall -O2 -o prog main.c util.c list.c -lreadline ; ./prog",
+    "echo \"a quoted string\" plain words |& tee log",
+    "ls >",
+    "a | | b",
+};
+
+/* Copy s into a buffer with the two trailing '\0' bytes the scanner needs */
+static char *
+scan_buffer(const char *s, size_t len)
+{
+    char *buf = malloc(len + 2);
+    memcpy(buf, s, len);
+    buf[len] = buf[len + 1] = '\0';
+    return buf;
+}
+
+/* Build a line of n copies of word, separated by sep */
+static char *
+repeat_line(const char *word, const char *sep, int n)
+{
+    size_t wlen = strlen(word), slen = strlen(sep);
+    char *line = malloc(n * (wlen + slen) + 1);
+    char *p = line;
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            memcpy(p, sep, slen);
+            p += slen;
+        }
+        memcpy(p, word, wlen);
+        p += wlen;
+    }
+    *p = '\0';
+    return line;
+}
+
+/*
+ * Parse each line 'rounds' times in place and report throughput
+ * and how many calls to the allocator each line costs, including
+ * freeing the result.
+ */
+static void
+parse_lines(const char *name, char **lines, int nlines, int rounds)
+{
+    size_t *len = malloc(nlines * sizeof *len);
+    char **buf = malloc(nlines * sizeof *buf);
+    size_t bytes = 0;
+    for (int i = 0; i < nlines; i++) {
+        len[i] = strlen(lines[i]);
+        buf[i] = scan_buffer(lines[i], len[i]);
+        bytes += len[i];
+    }
+
+    long calls = malloc_calls;
+    long long t0 = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < nlines; i++) {
+            struct ast_command_line *cline = ast_parse_command_buffer(buf[i], len[i]);
+            if (cline != NULL)
+                ast_command_line_free(cline);
+        }
+    }
+    long long elapsed = now_ns() - t0;
+    calls = malloc_calls - calls;
+
+    long nparsed = (long) rounds * nlines;
+    double secs = elapsed / 1e9;
+    printf("%-12s %8ld lines %8.1f ms %10.0f lines/s %8.1f MB/s %8.2f allocs/line\n",
+           name, nparsed, elapsed / 1e6, nparsed / secs,
+           (double) bytes * rounds / secs / 1e6, (double) calls / nparsed);
+
+    for (int i = 0; i < nlines; i++)
+        free(buf[i]);
+    free(buf);
+    free(len);
+}
+
+/*
+ * Parse a corpus of typical command lines, then a few pathological
+ * ones: a 500KB argument list, a 500KB quoted word, and a pipeline
+ * with 10000 stages.
+ */
+static int
+bench_parse(int ac, char *av[])
+{
+    int rounds = ac > 1 ? atoi(av[1]) : 100000;
+    int nlines = sizeof parse_corpus / sizeof parse_corpus[0];
+
+    /* parse errors are reported on stderr; keep them out of the way */
+    freopen("/dev/null", "w", stderr);
+
+    parse_lines("typical", (char **) parse_corpus, nlines, rounds);
+
+    char *quoted = repeat_line("x", "", 500 * 1024);
+    quoted[0] = quoted[strlen(quoted) - 1] = '"';
+    char *big[] = {
+        repeat_line("arg", " ", 500 * 1024 / 4),
+        quoted,
+        repeat_line("cat", " | ", 10000),
+    };
+    int nbig = sizeof big / sizeof big[0];
+    parse_lines("pathological", big, nbig, rounds / 10000 + 1);
+    for (int i = 0; i < nbig; i++)
+        free(big[i]);
+    return 0;
+}
+
+/*
+ * Parse a script of typical command lines with 1, 2, 4, ... worker
+ * threads, consuming the lines in order as the shell would.
+ */
+static int
+bench_script(int ac, char *av[])
+{
+    int nlines = ac > 1 ? atoi(av[1]) : 100000;
+    int maxthreads = ac > 2 ? atoi(av[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+    int ncorpus = sizeof parse_corpus / sizeof parse_corpus[0];
+
+    size_t len = 0;
+    for (int i = 0; i < nlines; i++)
+        len += strlen(parse_corpus[i % ncorpus]) + 1;
+
+    char *script = malloc(len), *p = script;
+    for (int i = 0; i < nlines; i++)
+        p = stpcpy(p, parse_corpus[i % ncorpus]), *p++ = '\n';
+
+    printf("%d lines, %.1f MB, %ld CPUs online\n",
+           nlines, len / 1e6, sysconf(_SC_NPROCESSORS_ONLN));
+
+    double base = 0;
+    for (int nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+        long long t0 = now_ns();
+        struct script_parser *parser = script_parser_create(script, len, nthreads);
+        struct parsed_line line;
+        int nparsed = 0;
+        while (script_parser_next(parser, &line)) {
+            if (line.cline != NULL)
+                ast_command_line_free(line.cline);
+            nparsed++;
+        }
+        script_parser_destroy(parser);
+        double secs = (now_ns() - t0) / 1e9;
+
+        if (nthreads == 1)
+            base = secs;
+        printf("%2d threads: %8.1f ms %10.0f lines/s  speedup %.2f%s\n",
+               nthreads, secs * 1e3, nparsed / secs, base / secs,
+               nparsed != nlines ? "  LINE COUNT MISMATCH" : "");
+    }
+    free(script);
+    return 0;
+}
+
+/*
+ * Run the shell with argv, stdin from 'input' (or /dev/null) and
+ * stdout discarded.  Returns the time taken in ns, or -1 if the shell
+ * failed.
+ */
+static long long
+run_shell(char *argv[], const char *input)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO,
+                                     input ? input : "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&fa, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    long long t0 = now_ns();
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, argv[0], &fa, NULL, argv, environ) != 0)
+        utils_fatal_error("cannot run %s: ", argv[0]);
+    waitpid(pid, &status, 0);
+    long long elapsed = now_ns() - t0;
+
+    posix_spawn_file_actions_destroy(&fa);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+/* Print the mean time of 'runs' runs of the shell */
+static void
+time_shell(const char *name, char *argv[], const char *input, int runs,
+           int lines)
+{
+    long long total = 0;
+    for (int i = 0; i < runs; i++) {
+        long long t = run_shell(argv, input);
+        if (t == -1) {
+            printf("%-26s failed\n", name);
+            return;
+        }
+        total += t;
+    }
+    double ms = total / 1e6 / runs;
+    if (lines > 0)
+        printf("%-26s %8.2f ms %10.0f lines/s\n", name, ms, lines / (ms / 1e3));
+    else
+        printf("%-26s %8.2f ms\n", name, ms);
+}
+
+/*
+ * Compare the script mode (cush script, cush -c) with feeding a
+ * script to cush through stdin, which goes through readline and
+ * needs a controlling terminal.  The script consists of builtins so
+ * that the shell's own overhead dominates.
+ */
+static int
+bench_startup(int ac, char *av[])
+{
+    int runs = ac > 1 ? atoi(av[1]) : 20;
+    int lines = ac > 2 ? atoi(av[2]) : 100000;
+    char *shell = ac > 3 ? av[3] : "./cush";
+
+    char oneline[] = "/tmp/cush-bench-1-XXXXXX";
+    char script[] = "/tmp/cush-bench-n-XXXXXX";
+    int fd1 = mkstemp(oneline), fdn = mkstemp(script);
+    if (fd1 == -1 || fdn == -1)
+        utils_fatal_error("mkstemp failed: ");
+
+    FILE *f = fdopen(fd1, "w");
+    fprintf(f, "true\n");
+    fclose(f);
+    f = fdopen(fdn, "w");
+    for (int i = 0; i < lines; i++)
+        fprintf(f, "cd .\n");
+    fclose(f);
+
+    printf("startup, mean of %d runs\n", runs);
+    time_shell("  cush -c true", (char *[]) { shell, "-c", "true", NULL },
+               NULL, runs, 0);
+    time_shell("  cush script", (char *[]) { shell, oneline, NULL },
+               NULL, runs, 0);
+    time_shell("  cush < script", (char *[]) { shell, NULL },
+               oneline, runs, 0);
+
+    printf("%d builtin commands\n", lines);
+    time_shell("  cush script", (char *[]) { shell, script, NULL },
+               NULL, 1, lines);
+    time_shell("  cush < script", (char *[]) { shell, NULL },
+               script, 1, lines);
+
+    unlink(oneline);
+    unlink(script);
+    return 0;
+}
+
+/* Write a script of 'iterations' rounds of test and echo, run as
+ * builtins or, with prefix "/usr/bin/", as external commands */
+static void
+write_loop_script(const char *path, int iterations, const char *prefix)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        utils_fatal_error("cannot write %s: ", path);
+    for (int i = 0; i < iterations; i++) {
+        fprintf(f, "%stest %d -lt %d\n", prefix, i, iterations);
+        fprintf(f, "%secho iteration %d\n", prefix, i);
+    }
+    fprintf(f, "true\n");
+    fclose(f);
+}
+
+/*
+ * Run a script that loops over test and echo, once with the builtins
+ * and once with the external commands.  The shell has no loop
+ * construct, so the script is unrolled.  External commands are slow
+ * enough that they get fewer iterations by default; rates are per
+ * iteration either way.
+ */
+static int
+bench_utils(int ac, char *av[])
+{
+    int iterations = ac > 1 ? atoi(av[1]) : 100000;
+    int external = ac > 2 ? atoi(av[2]) : iterations / 10;
+    char *shell = ac > 3 ? av[3] : "./cush";
+
+    char script[] = "/tmp/cush-bench-u-XXXXXX";
+    int fd = mkstemp(script);
+    if (fd == -1)
+        utils_fatal_error("mkstemp failed: ");
+    close(fd);
+
+    char name[64];
+    printf("iterations of test and echo, two lines each\n");
+    write_loop_script(script, iterations, "");
+    snprintf(name, sizeof name, "  %d builtin", iterations);
+    time_shell(name, (char *[]) { shell, script, NULL }, NULL, 1, 2 * iterations);
+    write_loop_script(script, external, "/usr/bin/");
+    snprintf(name, sizeof name, "  %d external", external);
+    time_shell(name, (char *[]) { shell, script, NULL }, NULL, 1, 2 * external);
+
+    unlink(script);
+    return 0;
+}
+
+static int
+bench_builtin_nop(char **argv)
+{
+    return 0;
+}
+
+/* The shell's builtin names, in the order of builtins.def */
+static const char *builtin_names[] = {
+#define BUILTIN(name, fn, caps) name,
+#include "builtins.def"
+#undef BUILTIN
+};
+
+/* What is_builtin() used to do: compare against each name in turn */
+static bool
+strcmp_chain(const char *name)
+{
+    for (int i = 0; i < sizeof builtin_names / sizeof builtin_names[0]; i++)
+        if (strcmp(name, builtin_names[i]) == 0)
+            return true;
+    return false;
+}
+
+/*
+ * Cost of deciding whether a command is a builtin, for the builtins
+ * themselves and for typical external commands, which a strcmp chain
+ * compares against every builtin.
+ */
+static int
+bench_builtins(int ac, char *av[])
+{
+    static const char *commands[] = { "ls", "grep", "cat", "sed", "make", "git" };
+    int rounds = ac > 1 ? atoi(av[1]) : 1000000;
+    int nbuiltins = sizeof builtin_names / sizeof builtin_names[0];
+    int ncommands = sizeof commands / sizeof commands[0];
+
+    for (int i = 0; i < nbuiltins; i++)
+        builtin_register(builtin_names[i], bench_builtin_nop, 0);
+
+    for (int table = 0; table < 2; table++) {
+        for (int set = 0; set < 2; set++) {
+            const char **names = set ? commands : builtin_names;
+            int n = set ? ncommands : nbuiltins;
+            long found = 0;
+            long long t0 = now_ns();
+            for (int r = 0; r < rounds; r++)
+                for (int i = 0; i < n; i++)
+                    found += table ? builtin_lookup(names[i]) != NULL
+                                   : strcmp_chain(names[i]);
+            double ns = (double) (now_ns() - t0) / rounds / n;
+            printf("%-13s %-9s %6.1f ns/lookup  (%ld found)\n",
+                   table ? "perfect hash" : "strcmp chain",
+                   set ? "commands" : "builtins", ns, found);
+        }
+    }
+    return 0;
+}
+
+static void
+count_match(const char *path, void *arg)
+{
+    (*(size_t *) arg)++;
+}
+
+/*
+ * Expand a pattern that matches half of a directory of 'n' files:
+ * with glob(3), then natively, once reading the directory each time
+ * and once from the directory cache.
+ */
+static int
+bench_glob(int ac, char *av[])
+{
+    int n = ac > 1 ? atoi(av[1]) : 100000;
+    int rounds = ac > 2 ? atoi(av[2]) : 20;
+
+    char dir[] = "/tmp/cush-bench-glob-XXXXXX";
+    if (mkdtemp(dir) == NULL)
+        utils_fatal_error("mkdtemp");
+    char path[PATH_MAX];
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof path, "%s/file%d.%s", dir, i, i % 2 ? "txt" : "log");
+        int fd = open(path, O_WRONLY | O_CREAT, 0644);
+        if (fd == -1)
+            utils_fatal_error("open");
+        close(fd);
+    }
+    /* A directory changed just now is not cached */
+    usleep(50000);
+
+    char pattern[PATH_MAX];
+    snprintf(pattern, sizeof pattern, "%s/*.log", dir);
+    printf("%d files, *.log, %d rounds\n", n, rounds);
+
+    size_t matches = 0;
+    long long start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        glob_t g;
+        if (glob(pattern, 0, NULL, &g) == 0)
+            matches = g.gl_pathc;
+        globfree(&g);
+    }
+    printf("  %-20s %8.2f ms per expansion, %zu matches\n", "glob(3)",
+           (now_ns() - start) / 1e6 / rounds, matches);
+
+    start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        dir_cache_clear();
+        matches = 0;
+        glob_expand(pattern, count_match, &matches);
+    }
+    printf("  %-20s %8.2f ms per expansion, %zu matches\n", "glob_expand, cold",
+           (now_ns() - start) / 1e6 / rounds, matches);
+
+    start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        matches = 0;
+        glob_expand(pattern, count_match, &matches);
+    }
+    printf("  %-20s %8.2f ms per expansion, %zu matches\n", "glob_expand, cached",
+           (now_ns() - start) / 1e6 / rounds, matches);
+
+    dir_cache_clear();
+    for (int i = 0; i < n; i++) {
+        snprintf(path, sizeof path, "%s/file%d.%s", dir, i, i % 2 ? "txt" : "log");
+        unlink(path);
+    }
+    rmdir(dir);
+    return 0;
+}
+
+static struct benchmark {
+    const char *name;
+    int (*run)(int ac, char *av[]);
+    const char *help;
+} benchmarks[] = {
+    { "reap", bench_reap, "[njobs]       reap latency with njobs live background jobs" },
+    { "spawn", bench_spawn, "[n] [rss_mb]  spawn-to-exec latency of each spawn backend" },
+    { "pipeline", bench_pipeline, "[stages] [runs]  starting a pipeline stage by stage and as a batch" },
+    { "builtins", bench_builtins, "[rounds]  builtin lookup: perfect hash versus strcmp chain" },
+    { "jid", bench_jid, "[live] [ops]   job id churn with 'live' jobs outstanding" },
+    { "parse", bench_parse, "[rounds]     parser throughput and allocator calls per line" },
+    { "script", bench_script, "[lines] [threads]  parallel parsing of a script" },
+    { "utils", bench_utils, "[n] [n_external] [shell]  test and echo as builtins and as commands" },
+    { "startup", bench_startup, "[runs] [lines] [shell]  script mode versus cush < script" },
+    { "glob", bench_glob, "[files] [rounds]  pattern expansion: glob(3), native, and cached" },
+};
+
+int
+main(int ac, char *av[])
+{
+    int nbench = sizeof benchmarks / sizeof benchmarks[0];
+    for (int i = 0; ac > 1 && i < nbench; i++)
+        if (strcmp(av[1], benchmarks[i].name) == 0)
+            return benchmarks[i].run(ac - 1, av + 1);
+
+    fprintf(stderr, "Usage: %s <benchmark> [args]\n", av[0]);
+    for (int i = 0; i < nbench; i++)
+        fprintf(stderr, "  %s %s\n", benchmarks[i].name, benchmarks[i].help);
+    return EXIT_FAILURE;
+}
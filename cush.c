@@ -16,6 +16,15 @@
 #include <spawn.h>
 #include <fcntl.h>
 #include <readline/history.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <getopt.h>
 
 /* Since the handed out code contains a number of unused functions. */
 #pragma GCC diagnostic ignored "-Wunused-function"
@@ -24,13 +33,40 @@
 #include "signal_support.h"
 #include "shell-ast.h"
 #include "utils.h"
-
-static void handle_child_status(pid_t pid, int status);
+#include "pid_index.h"
+#include "jid_allocator.h"
+#include "script_parser.h"
+#include "path_cache.h"
+#include "core_builtins.h"
+#include "builtin_table.h"
+#include "child_ring.h"
+#include "proc_usage.h"
+#include "shell_stats.h"
+#include "trace.h"
+#include "parallel.h"
+#include "arena.h"
+#include "admission.h"
+#include "glob_expand.h"
+
+static void handle_child_status(struct child_event *ev);
+struct job;
+static void job_check_done(struct job *job);
+static void job_start(struct job *job);
+static void exec_command(struct ast_pipeline *pipe);
+static bool apply_redirections(struct ast_pipeline *pipe, struct ast_command *cmd, int saved[3]);
+static int run_builtin(struct ast_pipeline *pipe, struct ast_command *cmd,
+                       const struct builtin *builtin);
+static int run_builtin_stage(char *const *argv);
+static int time_builtin(struct ast_pipeline *pipe, struct ast_command *cmd,
+                        const struct builtin *builtin);
+static int refuse_builtin_stage(char *const *argv);
+static void register_builtins(void);
+static void run_script_text(const char *text, size_t len, bool exec_last);
+static void run_script(const char *path, bool exec_last);
+static void wait_for_run_queue(void);
 
 void run_command(struct ast_command_line *command_line);
 
-int is_builtin(char **cmd);
-
 void jobs(void);
 
 void clean_joblist(void);
@@ -42,8 +78,11 @@ extern char **environ;
 static void
 usage(char *progname)
 {
-    printf("Usage: %s -h\n"
-           " -h            print this help\n",
+    printf("Usage: %s [-h] [--trace=file] [-c cmdline | script]\n"
+           " -h            print this help\n"
+           " --trace=file  write a trace of all jobs to file\n"
+           " -c cmdline    run cmdline and exit\n"
+           " script        run the commands in file script and exit\n",
            progname);
 
     exit(EXIT_SUCCESS);
@@ -64,6 +103,16 @@ enum job_status
     STOPPED,       /* job is stopped via SIGSTOP */
     NEEDSTERMINAL, /* job is stopped because it was a background job
                       and requires exclusive terminal access */
+    QUEUED,        /* background job waiting in the run queue until
+                      admission control lets it start */
+};
+
+/* One process of a job and the resources it used */
+struct process_usage
+{
+    char *const *argv;       /* The command the process runs */
+    struct proc_usage usage; /* Filled in when the process is reaped */
+    double elapsed;          /* Seconds from the start of the job until then */
 };
 
 struct job
@@ -76,20 +125,70 @@ struct job
     struct termios saved_tty_state; /* The state of the terminal when this job was
                                        stopped after having been in foreground */
     pid_t pgid; /*The process group id*/
-    pid_t pid_list[20]; /*Array of child process IDs*/
+    pid_t *pid_list; /*Array of child process IDs, one slot per command*/
+    int *pidfd_list; /*pidfd for each process in pid_list, -1 once reaped or if
+                       the kernel does not support pidfds*/
     bool saved_state_changed; /*This indicate if saved_tty_state was changed or not*/
     int num_pids; /*Number of process Id that was created*/
+    struct process_usage *usage_list; /*What each process in pid_list used*/
+    struct timespec started; /*When the job was started*/
+    bool timed; /*Report how long the job took once it is done*/
+    bool traced; /*A slice for the job's status is open in the trace*/
+    int trace_track; /*Where the job's status is traced, once traced*/
+    struct parallel_queue *queue; /*Commands a parallel job has yet to run, or NULL*/
+    struct list_elem done_elem; /*Link element for the completed jobs queue*/
+    int priority; /*Queued jobs with a higher priority start first*/
+    struct list_elem queue_elem; /*Link element for the run queue, while queued*/
+    bool counted_running; /*Counted in running_background*/
+    bool completed; /*On the completed jobs queue, waiting to be deleted*/
 };
 
 /* Utility functions for job list management.
  * We use 2 data structures:
  * (a) an array jid2job to quickly find a job based on its id
  * (b) a linked list to support iteration
+ * Free job ids are tracked by the jid allocator.
+ * Jobs whose last process has died are also queued on completed_jobs
+ * so that clean_joblist() does not have to look at every job.
+ * Background jobs that admission control holds back wait on run_queue,
+ * ordered by priority and then by when they were queued.
+ * running_background counts the background jobs with live processes,
+ * so admitting a job does not have to look at every job either.
  */
-#define MAXJOBS (1 << 16)
+#define MAXJOBS JID_LIMIT
 static struct list job_list;
+static struct list completed_jobs;
+static struct list run_queue;
+static int running_background;
 static struct job *jid2job[MAXJOBS];
 
+/* True if the shell owns the terminal and runs each job in its own
+ * process group.  Scripts and -c command lines run without job
+ * control; their jobs stay in the shell's process group. */
+static bool job_control;
+
+/* signalfd on which SIGCHLD is delivered */
+static int sigchld_fd;
+
+/* Set while the last line of a script or -c command line runs;
+ * its last command may then replace the shell. */
+static bool exec_last_command;
+
+/* When the line being run was parsed, until its first pipeline is
+ * spawned; 0 if there is no such line */
+static long long line_parsed_ns;
+
+/* The pipeline of the builtin that runs in the shell, while it runs */
+static struct ast_pipeline *builtin_pipeline;
+
+/* The job run_command is starting, while its stages are spawned */
+static struct job *starting_job;
+
+/* Exit status of the last command: that of a builtin, or of the last
+ * process of a foreground job, or 128 plus the signal that killed it.
+ * Scripts and -c command lines exit with it. */
+static int last_status;
+
 /* Return job corresponding to jid */
 static struct job *
 get_job_from_jid(int jid)
@@ -107,19 +206,28 @@ add_job(struct ast_pipeline *pipe)
     struct job *job = malloc(sizeof *job);
     job->pipe = pipe;
     job->num_processes_alive = 0;
-    list_push_back(&job_list, &job->elem);
-    for (int i = 1; i < MAXJOBS; i++)
+    job->num_pids = 0;
+    job->pid_list = NULL;
+    job->pidfd_list = NULL;
+    job->usage_list = NULL;
+    job->timed = false;
+    job->traced = false;
+    job->queue = NULL;
+    job->priority = 0;
+    job->counted_running = false;
+    job->completed = false;
+    job->pgid = 0;
+    job->saved_state_changed = false;
+    int jid = jid_alloc();
+    if (jid == -1)
     {
-        if (jid2job[i] == NULL)
-        {
-            jid2job[i] = job;
-            job->jid = i;
-            return job;
-        }
+        fprintf(stderr, "Maximum number of jobs exceeded\n");
+        abort();
     }
-    fprintf(stderr, "Maximum number of jobs exceeded\n");
-    abort();
-    return NULL;
+    list_push_back(&job_list, &job->elem);
+    jid2job[jid] = job;
+    job->jid = jid;
+    return job;
 }
 
 /* Delete a job.
@@ -131,12 +239,224 @@ delete_job(struct job *job)
 {
     int jid = job->jid;
     assert(jid != -1);
+    assert(!job->counted_running);
+    if (job->traced)
+    {
+        trace_end(job->trace_track, shell_stats_now(), NULL);
+    }
+    /* Reaped pids were already dropped from the index; only forget
+     * the ones that still refer to this job. */
+    for (int i = 0; i < job->num_pids; i++)
+    {
+        struct pid_index_entry *ent = pid_index_lookup(job->pid_list[i]);
+        if (ent != NULL && ent->owner == job)
+            pid_index_remove(job->pid_list[i]);
+        if (job->pidfd_list[i] != -1)
+            close(job->pidfd_list[i]);
+    }
     jid2job[jid]->jid = -1;
     jid2job[jid] = NULL;
+    jid_free(jid);
     ast_pipeline_free(job->pipe);
+    free(job->pid_list);
+    free(job->pidfd_list);
+    free(job->usage_list);
+    if (job->queue != NULL)
+        parallel_queue_free(job->queue);
     free(job);
 }
 
+/* Write the command line of 'pipeline' into buf, which has room for
+ * 'size' characters */
+static void
+format_cmdline(struct ast_pipeline *pipeline, char *buf, size_t size)
+{
+    size_t len = 0;
+    buf[0] = '\0';
+    for (struct list_elem *e = list_begin(&pipeline->commands);
+         e != list_end(&pipeline->commands) && len < size;
+         e = list_next(e))
+    {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        if (e != list_begin(&pipeline->commands))
+            len += snprintf(buf + len, size - len, " |");
+        for (char **p = cmd->argv; *p != NULL && len < size; p++)
+            len += snprintf(buf + len, size - len, len == 0 ? "%s" : " %s", *p);
+    }
+}
+
+/* Count 'job' in running_background while it is a background job with
+ * live processes.  Called whenever either of those changes. */
+static void
+job_update_running(struct job *job)
+{
+    bool running = job->status == BACKGROUND && job->num_processes_alive > 0;
+    if (running != job->counted_running)
+    {
+        running_background += running ? 1 : -1;
+        job->counted_running = running;
+    }
+}
+
+/* Change the status of a job, and trace the change as the end of the
+ * slice for the old status and the start of one for the new one */
+static void
+job_set_status(struct job *job, enum job_status status)
+{
+    static const char *names[] = {
+        [FOREGROUND] = "FOREGROUND",
+        [BACKGROUND] = "BACKGROUND",
+        [STOPPED] = "STOPPED",
+        [NEEDSTERMINAL] = "NEEDSTERMINAL",
+        [QUEUED] = "QUEUED",
+    };
+    job->status = status;
+    job_update_running(job);
+    if (!trace_enabled())
+        return;
+
+    static int jobs_traced;
+    long long now = shell_stats_now();
+    if (job->traced)
+    {
+        trace_end(job->trace_track, now, NULL);
+    }
+    else
+    {
+        job->trace_track = trace_job_track(++jobs_traced);
+        char name[256];
+        int len = snprintf(name, sizeof name, "[%d] ", job->jid);
+        format_cmdline(job->pipe, name + len, sizeof name - len);
+        trace_track_name(job->trace_track, name);
+    }
+    trace_begin(job->trace_track, names[status], now, NULL);
+    job->traced = true;
+}
+
+/* Return true if process i of this job has not been reaped yet */
+static bool
+job_process_alive(struct job *job, int i)
+{
+    struct pid_index_entry *ent = pid_index_lookup(job->pid_list[i]);
+    return ent != NULL && ent->owner == job;
+}
+
+/* Seconds since 'start' */
+static double
+seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Print "real R " followed by 'usage' and a newline to stderr */
+static void
+print_time(double real, const struct proc_usage *usage)
+{
+    fprintf(stderr, "real %.3fs ", real);
+    proc_usage_print(stderr, usage);
+    fprintf(stderr, "\n");
+}
+
+/* Report what a job started with "time" took: the whole pipeline,
+ * then each of its processes, so a slow stage stands out. */
+static void
+print_job_time(struct job *job)
+{
+    struct proc_usage total = {0};
+    double real = 0;
+    for (int i = 0; i < job->num_pids; i++)
+    {
+        proc_usage_add(&total, &job->usage_list[i].usage);
+        if (job->usage_list[i].elapsed > real)
+            real = job->usage_list[i].elapsed;
+    }
+    print_time(real, &total);
+    if (job->num_pids < 2)
+        return;
+
+    for (int i = 0; i < job->num_pids; i++)
+    {
+        fprintf(stderr, "%4d %-12s ", i + 1, job->usage_list[i].argv[0]);
+        print_time(job->usage_list[i].elapsed, &job->usage_list[i].usage);
+    }
+}
+
+/* Queue a job whose processes have all terminated for deletion
+ * by clean_joblist(), unless it is queued already */
+static void
+job_completed(struct job *job)
+{
+    if (job->completed)
+        return;
+    job->completed = true;
+    if (job->timed && job->num_pids > 0)
+        print_job_time(job);
+    list_push_back(&completed_jobs, &job->done_elem);
+}
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1UL << 2)
+#endif
+
+/* Send signal 'sig' to the process group of a job.
+ * While the group leader has not been reaped, the signal is sent
+ * through its pidfd, so it cannot reach an unrelated process group
+ * that happens to reuse the pgid.  Fall back to killpg() after that,
+ * and on kernels without pidfds or without PIDFD_SIGNAL_PROCESS_GROUP.
+ * Without job control the job shares the shell's process group, so
+ * each of its processes is signaled on its own. */
+static int
+job_signal(struct job *job, int sig)
+{
+    /* A parallel job that is told to end starts no more commands */
+    if (job->queue != NULL && sig != SIGCONT && sig != SIGSTOP && sig != SIGTSTP &&
+        !parallel_queue_done(job->queue))
+    {
+        job->queue->cancelled = true;
+        job_check_done(job);
+    }
+    if (job->num_processes_alive == 0)
+    {
+        errno = ESRCH;
+        return -1;
+    }
+    if (trace_enabled() && job->traced)
+    {
+        char name[32];
+        snprintf(name, sizeof name, "SIG%s", sigabbrev_np(sig));
+        trace_instant(job->trace_track, name, shell_stats_now(), NULL);
+    }
+    if (!job_control)
+    {
+        for (int i = 0; i < job->num_pids; i++)
+        {
+            if (!job_process_alive(job, i))
+                continue;
+            if (job->pidfd_list[i] != -1)
+                syscall(SYS_pidfd_send_signal, job->pidfd_list[i], sig, NULL, 0);
+            else
+                kill(job->pid_list[i], sig);
+        }
+        return 0;
+    }
+    /* The kernel signals the group whose id is the pidfd's pid, so
+       only the leader's pidfd will do.  Once the leader is reaped,
+       the group may live on in the other processes; killpg() then. */
+    for (int i = 0; i < job->num_pids; i++)
+    {
+        if (job->pid_list[i] != job->pgid || job->pidfd_list[i] == -1)
+            continue;
+        if (syscall(SYS_pidfd_send_signal, job->pidfd_list[i], sig, NULL, PIDFD_SIGNAL_PROCESS_GROUP) == 0)
+            return 0;
+        if (errno != EINVAL && errno != ESRCH)
+            return -1;
+        break;
+    }
+    return killpg(job->pgid, sig);
+}
+
 /* Get a current status of a job */
 static const char *
 get_status(enum job_status status)
@@ -151,6 +471,8 @@ get_status(enum job_status status)
         return "Stopped";
     case NEEDSTERMINAL:
         return "Stopped (tty)";
+    case QUEUED:
+        return "Queued";
     default:
         return "Unknown";
     }
@@ -182,32 +504,75 @@ print_job(struct job *job)
     printf(")\n");
 }
 
+/* Print the resources each process of a job has used so far, and the
+ * sum for the whole job.  Processes that are still running are
+ * looked up in /proc. */
+static void
+print_job_usage(struct job *job)
+{
+    struct proc_usage total = {0};
+    for (int i = 0; i < job->num_pids; i++)
+    {
+        struct proc_usage usage = job->usage_list[i].usage;
+        if (job_process_alive(job, i) && !proc_usage_read(job->pid_list[i], &usage))
+            continue;
+        proc_usage_add(&total, &usage);
+        printf("\t%-7d %-12s ", job->pid_list[i], job->usage_list[i].argv[0]);
+        proc_usage_print(stdout, &usage);
+        printf("\n");
+    }
+    printf("\t%-20s ", "total");
+    proc_usage_print(stdout, &total);
+    printf("\t%.3fs\n", seconds_since(&job->started));
+}
+
 /*
- * Suggested SIGCHLD handler.
+ * SIGCHLD is kept blocked at all times and delivered through a
+ * signalfd that the main loop watches alongside the terminal, so
+ * child status changes are handled synchronously, never in signal
+ * context.
  *
- * Call waitpid() to learn about any child processes that
- * have exited or changed status (been stopped, needed the
- * terminal, etc.)
- * Just record the information by updating the job list
- * data structures.  Since the call may be spurious (e.g.
- * an already pending SIGCHLD is delivered even though
- * a foreground process was already reaped), ignore when
- * waitpid returns -1.
- * Use a loop with WNOHANG since only a single SIGCHLD
- * signal may be delivered for multiple children that have
- * exited. All of them need to be reaped.
+ * Reaping and handling are separate steps: child_ring_reap() collects
+ * what wait4 reports into the child ring, and drain_children() updates
+ * the job list from the ring in one pass.
  */
-static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
-{
-    pid_t child;
-    int status;
 
-    assert(sig == SIGCHLD);
+/* Handle every status change in the child ring.  Returns how many. */
+static int drain_children(void)
+{
+    struct child_event ev;
+    int n = 0;
 
-    while ((child = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0)
+    while (child_ring_pop(&ev))
     {
-        handle_child_status(child, status);
+        handle_child_status(&ev);
+        shell_stats_since(STAT_REAP, ev.reaped_ns);
+        n++;
     }
+    return n;
+}
+
+/*
+ * Reap every child that changed state (exited, been stopped,
+ * needed the terminal, etc.) since the last call and record the
+ * information by updating the job list data structures.  A single
+ * SIGCHLD may stand for many children, so keep reaping until there
+ * are no more; the ring is drained whenever it fills up.  Returns
+ * the number of children handled.
+ */
+static int reap_children(void)
+{
+    struct signalfd_siginfo info[16];
+    int n = 0;
+
+    /* Consume the pending notifications; wait4 tells us the rest */
+    while (read(sigchld_fd, info, sizeof info) > 0)
+        continue;
+
+    do
+        n += drain_children();
+    while (child_ring_reap(-1, WUNTRACED | WNOHANG) > 0);
+    return n;
 }
 
 /* Wait for all processes in this job to complete, or for
@@ -217,7 +582,7 @@ static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
  * 'fg' command.
  *
  * Implement handle_child_status such that it records the
- * information obtained from waitpid() for pid 'child.'
+ * information obtained from wait4() for pid 'child.'
  *
  * If a process exited, it must find the job to which it
  * belongs and decrement num_processes_alive.
@@ -236,478 +601,1748 @@ static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt)
 static void wait_for_job(struct job *job)
 {
     assert(signal_is_blocked(SIGCHLD));
+    int next = 0; /* without job control, the process to wait for next */
 
     while (job->status == FOREGROUND && job->num_processes_alive > 0)
     {
+        int n;
 
-        int status;
-
-        pid_t child = waitpid(-1, &status, WUNTRACED);
+        /* Only wait for this job's process group; other jobs' children are
+           left for the event loop to reap.  Once one of its processes
+           changes state, the others that already did are reaped along
+           with it and handled in the same batch. */
+        if (job_control)
+        {
+            n = child_ring_reap(-job->pgid, WUNTRACED);
+        }
+        else
+        {
+            /* The job shares the shell's process group, so wait for
+               its processes one at a time. */
+            while (!job_process_alive(job, next))
+                next++;
+            n = child_ring_reap(job->pid_list[next], WUNTRACED);
+        }
 
-        // When called here, any error returned by waitpid indicates a logic
+        // When called here, any error returned by wait4 indicates a logic
         // bug in the shell.
         // In particular, ECHILD "No child process" means that there has
-        // already been a successful waitpid() call that reaped the child, so
+        // already been a successful wait4() call that reaped the child, so
         // there's likely a bug in handle_child_status where it failed to update
         // the "job" status and/or num_processes_alive fields in the required
         // fashion.
         // Since SIGCHLD is blocked, there cannot be races where a child's exit
         // was handled via the SIGCHLD signal handler.
-        if (child != -1)
-            handle_child_status(child, status);
+        if (n != -1)
+            drain_children();
         else
-            utils_fatal_error("waitpid failed, see code for explanation");
+            utils_fatal_error("wait4 failed, see code for explanation");
     }
 }
 
-/* With the given pid and status determine which job is this pid part of and determine what
-    satuts change occurred using the WIF() macros. Then, undate the job status accordingly,
-    and adjust num_process alive if process died. If a process was stopped, save the terminal state.*/
-static void handle_child_status(pid_t pid, int status)
+/* Trace a stage that was spawned: a slice from the start of its
+ * spawn until it ran its program, then one for as long as it runs */
+static void
+trace_stage(posix_spawn_stage_t *stage)
 {
-    assert(signal_is_blocked(SIGCHLD));
-    /* interate through the job list */
-    for (struct list_elem *e = list_begin(&job_list);
-         e != list_end(&job_list);
-         e = list_next(e))
+    trace_track_name(stage->pid, stage->argv[0]);
+    trace_complete(stage->pid, "spawn", stage->spawn_start_ns, stage->spawn_ns, NULL);
+    trace_begin(stage->pid, stage->argv[0], stage->spawn_start_ns + stage->spawn_ns, NULL);
+}
+
+/* Add the process that 'stage' started to a job */
+static void
+job_add_process(struct job *job, posix_spawn_stage_t *stage)
+{
+    int slot = job->num_pids++;
+    shell_stats_record(STAT_EXEC, stage->spawn_ns);
+    job->pid_list[slot] = stage->pid;
+    job->pidfd_list[slot] = stage->pidfd;
+    job->usage_list[slot].argv = stage->argv;
+    if (trace_enabled())
     {
-        struct job *job1 = list_entry(e, struct job, elem);
-        job1->saved_state_changed = false;
-        /* for each job -> pid_list and compare every one of them */
-        for (int i = 0; i < job1->num_pids; i++)
-        {
-            /* If found the job that has the given pid part of it*/
-            if ((job1->pid_list[i]) == pid)
-            {
-                /* Process stopped not dead
-                 so no decrement in num process alive in this job 
-                 but change the status of current job */
-                if (WIFSTOPPED(status))
-                {
-                    // User stops FOREGROUND process with Ctrl-Z
-                    if (WSTOPSIG(status) == SIGTSTP)
-                    {
-                        job1->status = STOPPED;
-                        print_job(job1);
-                        termstate_save(&job1->saved_tty_state);
-                        job1->saved_state_changed = true;
-                    }
-                    // User stops process with kill -STOP
-                    else if (WSTOPSIG(status) == SIGSTOP)
-                    {
-                        job1->status = STOPPED;
-                        termstate_save(&job1->saved_tty_state);
-                        job1->saved_state_changed = true;
-                    }
-                    // non-foreground processs wants terminal access
-                    else if (WSTOPSIG(status) == SIGTTOU || WSTOPSIG(status) == SIGTTIN)
-                    {
-                        job1->status = NEEDSTERMINAL;
-                        termstate_save(&job1->saved_tty_state);
-                        job1->saved_state_changed = true;
-                    }
-                }
-                /* When process terminated regularly (General case)
-                    decrement the number of process alive*/
-                else if (WIFEXITED(status))
-                {
-                    /* If job is in FOREGRONG sample the last know good state
-                        of terminal*/
-                    if (job1->status == FOREGROUND)
-                    {
-                        termstate_sample();
-                    }
-                    job1->num_processes_alive--;
-                }
-                /*  When process get specific signal and terminated manually
-                    Decrement the number of process alive */
-                else if (WIFSIGNALED(status))
-                {
-                    if (WTERMSIG(status) == SIGFPE)
-                    {
-                        printf("floating point exception\n");
-                    }
-                    if (WTERMSIG(status) == SIGSEGV)
-                    {
-                        printf("segmentation fault\n");
-                    }
-                    if (WTERMSIG(status) == SIGABRT)
-                    {
-                        printf("aborted\n");
-                    }
-                    if (WTERMSIG(status) == SIGKILL)
-                    {
-                        printf("killed\n");
-                    }
-                    if (WTERMSIG(status) == SIGTERM)
-                    {
-                        printf("terminated\n");
-                    }
-                    job1->num_processes_alive--;
-                }
-            }
-        }
+        trace_stage(stage);
     }
+    pid_index_insert(stage->pid, job, slot);
+    job->num_processes_alive++;
+    job_update_running(job);
 }
 
-int main(int ac, char *av[])
+/* Queue a job for deletion once it has nothing left to run.  A
+ * parallel job exits with the number of its commands that failed,
+ * up to 101. */
+static void
+job_check_done(struct job *job)
 {
-    int opt;
-    // Sets up history
-    using_history();
+    if (job->num_processes_alive > 0 || (job->queue != NULL && !parallel_queue_done(job->queue)))
+        return;
+    if (job->queue != NULL && job->status == FOREGROUND)
+        last_status = job->queue->failed < 101 ? job->queue->failed : 101;
+    job_completed(job);
+}
 
-    /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0)
+/* Put a job into the run queue behind the jobs with the same or a
+ * higher priority */
+static void
+run_queue_insert(struct job *job)
+{
+    struct list_elem *e = list_begin(&run_queue);
+    while (e != list_end(&run_queue) && list_entry(e, struct job, queue_elem)->priority >= job->priority)
+        e = list_next(e);
+    list_insert(e, &job->queue_elem);
+}
+
+/* Make a new background job BACKGROUND if admission control lets it
+ * start now, or QUEUED otherwise.  While jobs are queued, new ones
+ * wait behind them.  Returns true if the job may start. */
+static bool
+job_admit(struct job *job)
+{
+    if (list_empty(&run_queue) && admission_allows(running_background))
     {
-        switch (opt)
-        {
-        case 'h':
-            usage(av[0]);
-            break;
-        }
+        job_set_status(job, BACKGROUND);
+        return true;
     }
-
-    list_init(&job_list);
-    signal_set_handler(SIGCHLD, sigchld_handler);
-    termstate_init();
-
-    /* Read/eval loop. */
-    for (;;)
+    job_set_status(job, QUEUED);
+    run_queue_insert(job);
+    if (job_control)
     {
+        printf("[%d] queued\n", job->jid);
+    }
+    return false;
+}
 
-        /* If you fail this assertion, you were about to enter readline()
-         * while SIGCHLD is blocked.  This means that your shell would be
-         * unable to receive SIGCHLD signals, and thus would be unable to
-         * wait for background jobs that may finish while the
-         * shell is sitting at the prompt waiting for user input.
-         */
-        assert(!signal_is_blocked(SIGCHLD));
+/* Take a job off the run queue and start it with the given status */
+static void
+job_dequeue(struct job *job, enum job_status status)
+{
+    list_remove(&job->queue_elem);
+    job_set_status(job, status);
+    job_start(job);
+}
 
-        /* If you fail this assertion, you were about to call readline()
-         * without having terminal ownership.
-         * This would lead to the suspension of your shell with SIGTTOU.
-         * Make sure that you call termstate_give_terminal_back_to_shell()
-         * before returning here on all paths.
-         */
-        assert(termstate_get_current_terminal_owner() == getpgrp());
+/* True if the job at the head of the run queue may start now */
+static bool
+run_queue_ready(void)
+{
+    return !list_empty(&run_queue) && admission_allows(running_background);
+}
 
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char *prompt = isatty(0) ? build_prompt() : NULL;
-        char *cmdline = readline(prompt);
-        free(prompt);
+/* Start queued jobs, highest priority and longest waiting first, for
+ * as long as admission control lets them */
+static void
+start_queued_jobs(void)
+{
+    while (run_queue_ready())
+    {
+        job_dequeue(list_entry(list_front(&run_queue), struct job, queue_elem), BACKGROUND);
+    }
+}
 
-        clean_joblist();
+/* Start commands of a parallel job until as many run as -j allows,
+ * or none are left.  The first one leads the job's process group and
+ * the others join it.  Once all members of the group are gone, the
+ * next command starts a new group, which takes the terminal if the
+ * job is in the foreground. */
+static void
+parallel_fill(struct job *job)
+{
+    struct parallel_queue *queue = job->queue;
+    sigset_t child_sigmask;
+    sigemptyset(&child_sigmask);
 
-        if (cmdline == NULL) /* User typed EOF */
+    while ((job->status == FOREGROUND || job->status == BACKGROUND) &&
+           job->num_processes_alive < queue->max_running)
+    {
+        char **argv = parallel_queue_next(queue);
+        if (argv == NULL)
             break;
 
-        // Checks for event discriptors for history and adds command to history
-        char *eventCheck;
-        history_expand(cmdline, &eventCheck);
-        if (strstr(cmdline, "!") || strstr(cmdline, "^"))
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigmask(&attr, &child_sigmask);
+        short flags = POSIX_SPAWN_SETSIGMASK;
+        if (job_control)
         {
-            add_history(eventCheck);
-            cmdline = eventCheck;
+            flags |= POSIX_SPAWN_SETPGROUP;
+            if (job->num_processes_alive > 0)
+            {
+                posix_spawnattr_setpgroup(&attr, job->pgid);
+            }
+            else if (job->status == FOREGROUND)
+            {
+                flags |= POSIX_SPAWN_TCSETPGROUP;
+                posix_spawnattr_tcsetpgrp_np(&attr, termstate_get_tty_fd());
+            }
         }
-        else
+        posix_spawnattr_setflags(&attr, flags);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        for (int fd = 0; fd < 3; fd++)
         {
-            add_history(cmdline);
+            if (queue->stdio[fd] != -1)
+                posix_spawn_file_actions_adddup2(&actions, queue->stdio[fd], fd);
         }
-
-        struct ast_command_line *cline = ast_parse_command_line(cmdline);
-        free(cmdline);
-        if (cline == NULL) /* Error in command line */
-            continue;
-
-        if (list_empty(&cline->pipes))
-        { /* User hit enter */
-            ast_command_line_free(cline);
-            continue;
+        int output = queue->group ? memfd_create("parallel", MFD_CLOEXEC) : -1;
+        if (output != -1)
+        {
+            posix_spawn_file_actions_adddup2(&actions, output, STDOUT_FILENO);
+            posix_spawn_file_actions_adddup2(&actions, output, STDERR_FILENO);
         }
 
-        run_command(cline);
+        posix_spawn_stage_t stage = {.argv = argv, .file_actions = &actions};
+        const struct builtin *builtin = builtin_lookup(argv[0]);
+        const char *path = NULL;
+        if (builtin != NULL)
+        {
+            stage.fn = builtin->caps & BUILTIN_PIPELINE ? run_builtin_stage : refuse_builtin_stage;
+        }
+        else if (strchr(argv[0], '/') == NULL)
+        {
+            path = path_cache_lookup(argv[0]);
+        }
+        stage.file = path != NULL ? path : argv[0];
+        stage.use_path = path == NULL;
 
-        // ast_command_line_print(cline);      /* Output a representation of
-        //  the entered command line */
+        fflush(stdout);
+        posix_spawn_pipeline_np(&stage, 1, &attr, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
 
-        /* Free the command line.
-         * This will free the ast_pipeline objects still contained
-         * in the ast_command_line.  Once you implement a job list
-         * that may take ownership of ast_pipeline objects that are
-         * associated with jobs you will need to reconsider how you
-         * manage the lifetime of the associated ast_pipelines.
-         * Otherwise, freeing here will cause use-after-free errors.
-         */
-        // ast_command_line_free(cline);
+        if (stage.error != 0)
+        {
+            printf("no such file or directory\n");
+            queue->failed++;
+            if (output != -1)
+                close(output);
+            continue;
+        }
+        if (job->num_processes_alive == 0)
+        {
+            job->pgid = job_control ? stage.pid : getpgrp();
+        }
+        queue->output[job->num_pids] = output;
+        job_add_process(job, &stage);
     }
-    return 0;
 }
 
-/* Based on the parsing that was handled in main, this function run commands.
-    First for loop go over all the pipe lines in command line.
-        after that this function determine if the pipe is built in or not
-
-        If built ins, built in functions are runned
-
-        If pipe is not built in job is added to job list
-            Second for loop goes over all the commands in pipe line
-                for each command we check if input or output need to be redircted
-                and create pipeline if there are more than one commands in pipe
-                Process group is created before creating the child process
-                Close all the pipes if pipes were created
-                Wait for all processes in this job to complete, or for
-                    the job no longer to be in the foreground.
-                After all this give terminal back to shell
-*/
-void run_command(struct ast_command_line *command_line)
+/* A process of a parallel job terminated: pass on the output it was
+ * made to keep, and start the next command in its place.  Commands
+ * killed by a signal that usually means stop cancel the rest. */
+static void
+parallel_process_done(struct job *job, int slot, struct child_event *ev)
 {
-    for (struct list_elem *e = list_begin(&command_line->pipes);
-         e != list_end(&command_line->pipes);
-         e = list_next(e))
+    struct parallel_queue *queue = job->queue;
+    int status = ev->status;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        queue->failed++;
+    if (WIFSIGNALED(status) && (WTERMSIG(status) == SIGINT || WTERMSIG(status) == SIGTERM ||
+                                WTERMSIG(status) == SIGKILL || WTERMSIG(status) == SIGHUP))
+        queue->cancelled = true;
+
+    int output = queue->output[slot];
+    if (output != -1)
     {
-        struct ast_pipeline *pipe1 = list_entry(e, struct ast_pipeline, elem);
-
-        struct list_elem *e = list_begin(&pipe1->commands);
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        char **p = cmd->argv;
-        struct job *job1 = NULL;
-        int builtint = is_builtin(p);
-        int count = 0;
-        int size1 = list_size(&pipe1->commands);
-        int fd[999][2];
-
-        if (builtint == 1)
+        char buf[65536];
+        ssize_t n;
+        fflush(stdout);
+        lseek(output, 0, SEEK_SET);
+        while ((n = read(output, buf, sizeof buf)) > 0)
         {
-            job1 = add_job(pipe1);
-            for (struct list_elem *e = list_begin(&pipe1->commands);
-                 e != list_end(&pipe1->commands);
-                 e = list_next(e))
-            {
-                posix_spawn_file_actions_t file_action;
-                posix_spawnattr_t posix_attr;
-                posix_spawnattr_init(&posix_attr);
-                posix_spawn_file_actions_init(&file_action);
-
-                // If not null last command should write to file iored_outputs
-                if (pipe1->iored_input)
-                {
-                    posix_spawn_file_actions_addopen(&file_action, STDIN_FILENO, pipe1->iored_input, O_RDONLY, 0);
-                }
-                // If not null first command should read to file iored_input
-                if (pipe1->iored_output)
-                {
-                    if (pipe1->append_to_output)
-                                                                                                                                                                                               {
-                        posix_spawn_file_actions_addopen(&file_action, STDOUT_FILENO, pipe1->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                        posix_spawn_file_actions_addopen(&file_action, STDERR_FILENO, pipe1->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0644);
-                    }
-                    else
-                    {
-                        posix_spawn_file_actions_addopen(&file_action, STDOUT_FILENO, pipe1->iored_output, O_CREAT | O_RDWR, 0666);
-                    }
-                    if (cmd->dup_stderr_to_stdout)
-                    {
-                        posix_spawn_file_actions_adddup2(&file_action, STDOUT_FILENO, STDERR_FILENO);
-                    }
-                }
-
-                if (pipe1->bg_job)
-                {
-                    job1->status = BACKGROUND;
-                }
-                else
-                {
-                    job1->status = FOREGROUND;
-                }
-
-                if (size1 > 1)
-                {
-                    // First command
-                    if (count == 0)
-                    {
-                        pipe2(fd[count], __O_CLOEXEC);
-                        posix_spawn_file_actions_adddup2(&file_action, fd[count][1], STDOUT_FILENO);
-                    }
-                    // Middle command
-                    else if (count != 0 && count != (size1 - 1))
-                    {
-                        pipe2(fd[count], __O_CLOEXEC);
-                        posix_spawn_file_actions_adddup2(&file_action, fd[count - 1][0], STDIN_FILENO);
-                        posix_spawn_file_actions_adddup2(&file_action, fd[count][1], STDOUT_FILENO);
-                    }
-                    // Last command
-                    else
-                    {
-                        posix_spawn_file_actions_adddup2(&file_action, fd[count - 1][0], STDIN_FILENO);
-                    }
-                }
-                count++;
-                struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-                char **p = cmd->argv;
-
-                if (count == 1)
-                {
-                    if (job1->status == FOREGROUND)
-                    {
-                        posix_spawnattr_setflags(&posix_attr, POSIX_SPAWN_TCSETPGROUP | POSIX_SPAWN_SETPGROUP);
-                        int fd = termstate_get_tty_fd();
-                        posix_spawnattr_tcsetpgrp_np(&posix_attr, fd);
-                    }
-                    else
-                    {
-                        posix_spawnattr_setflags(&posix_attr, POSIX_SPAWN_SETPGROUP);
-                        posix_spawnattr_setpgroup(&posix_attr, 0);
-                    }
-                }
-                else
-                {
-                    posix_spawnattr_setflags(&posix_attr, POSIX_SPAWN_SETPGROUP);
-                    posix_spawnattr_setpgroup(&posix_attr, job1->pgid);
-                }
-
-                if (cmd->dup_stderr_to_stdout)
-                {
-                    posix_spawn_file_actions_adddup2(&file_action, STDOUT_FILENO, STDERR_FILENO);
-                    printf("  stderr shall also be redirected\n");
-                }
-
-                if (posix_spawnp(&job1->pid_list[count - 1], p[0], &file_action, &posix_attr, p, environ) == 0)
-                {
-                    if (job1->status == BACKGROUND && job1->num_processes_alive == 0)
-                    {
-                        printf("[%d] %d\n", job1->jid, job1->pid_list[0]);
-                    }
-                    job1->num_pids++;
-                    job1->num_processes_alive++;
-                }
-                else
-                {
-                    printf("no such file or directory\n");
-                }
-                if (job1->num_processes_alive == 1)
-                {
-                    job1->pgid = job1->pid_list[0];
-                }
-            }
-            if (size1 > 1)
-            {
-                // close all pipe
-                for (int i = 0; i < (list_size(&pipe1->commands) - 1); i++)
-                {
-                    for (int j = 0; j < 2; j++)
-                    {
-                        close(fd[i][j]);
-                    }
-                }
-            }
-            signal_block(SIGCHLD);
-            wait_for_job(job1);
-            signal_unblock(SIGCHLD);
-            termstate_give_terminal_back_to_shell();
+            if (write(queue->stdio[STDOUT_FILENO], buf, n) != n)
+                break;
         }
+        close(output);
+        queue->output[slot] = -1;
     }
+    parallel_fill(job);
 }
 
-/* 
-    This function determines if command line is a built in or not
-    if command line is a built in, corresponding functionality was implemented.
-        Return 0 if built in
-        Return 1 if not built in
- */
-int is_builtin(char **cmd)
+/* Record that the process in pid index entry 'ent' of this job
+ * terminated, and what it used as reported in 'ev' */
+static void
+process_terminated(struct job *job, struct pid_index_entry *ent, struct child_event *ev)
 {
-    if (strcmp(cmd[0], "kill") == 0)
+    int slot = ent->slot;
+    job->usage_list[slot].usage = ev->usage;
+    job->usage_list[slot].elapsed = seconds_since(&job->started);
+    if (trace_enabled())
     {
+        char args[64];
+        if (WIFSIGNALED(ev->status))
+            snprintf(args, sizeof args, "{\"signal\":\"SIG%s\"}", sigabbrev_np(WTERMSIG(ev->status)));
+        else
+            snprintf(args, sizeof args, "{\"exit\":%d}", WEXITSTATUS(ev->status));
+        trace_end(ent->pid, ev->reaped_ns, args);
+    }
 
-        int jid = atoi(cmd[1]);
-        struct job *job1 = get_job_from_jid(jid);
+    int *pidfd = &job->pidfd_list[slot];
+    if (*pidfd != -1)
+    {
+        close(*pidfd);
+        *pidfd = -1;
+    }
+    pid_index_remove(ent->pid);
+    job->num_processes_alive--;
+    job_update_running(job);
+    if (job->queue != NULL)
+        parallel_process_done(job, slot, ev);
+    job_check_done(job);
+}
 
-        if (job1 == NULL)
+/* With the given pid and status determine which job is this pid part of and determine what
+    satuts change occurred using the WIF() macros. Then, undate the job status accordingly,
+    and adjust num_process alive if process died. If a process was stopped, save the terminal state.
+    The owning job is found through the pid index, so this does not depend on the number of jobs.*/
+static void handle_child_status(struct child_event *ev)
+{
+    assert(signal_is_blocked(SIGCHLD));
+    int status = ev->status;
+    struct pid_index_entry *ent = pid_index_lookup(ev->pid);
+    if (ent == NULL)
+        return;
+
+    struct job *job1 = ent->owner;
+    /* Process stopped not dead
+     so no decrement in num process alive in this job 
+     but change the status of current job */
+    if (WIFSTOPPED(status))
+    {
+        // User stops FOREGROUND process with Ctrl-Z
+        if (WSTOPSIG(status) == SIGTSTP)
         {
-            printf("the process was not killed \n");
+            job_set_status(job1, STOPPED);
+            print_job(job1);
         }
-        else
+        // User stops process with kill -STOP
+        else if (WSTOPSIG(status) == SIGSTOP)
         {
-            killpg(job1->pgid, SIGTERM);
+            job_set_status(job1, STOPPED);
         }
-        return 0;
-    }
-    else if (strcmp(cmd[0], "fg") == 0)
-    {
-        int jid = atoi(cmd[1]);
-        struct job *job1 = get_job_from_jid(jid);
-        print_cmdline(job1->pipe);
-        printf("\n");
-        job1->status = FOREGROUND;
-        if (job1->saved_state_changed == false)
+        // non-foreground processs wants terminal access
+        else if (WSTOPSIG(status) == SIGTTOU || WSTOPSIG(status) == SIGTTIN)
         {
-            termstate_give_terminal_to(NULL, job1->pgid);
+            job_set_status(job1, NEEDSTERMINAL);
         }
         else
         {
-            termstate_give_terminal_to(&job1->saved_tty_state, job1->pgid);
+            return;
+        }
+        if (job_control)
+        {
+            termstate_save(&job1->saved_tty_state);
+            job1->saved_state_changed = true;
         }
-        killpg(job1->pgid, SIGCONT);
-        signal_block(SIGCHLD);
-        wait_for_job(job1);
-        signal_unblock(SIGCHLD);
-        termstate_give_terminal_back_to_shell();
-        return 0;
-    }
-    else if (strcmp(cmd[0], "bg") == 0)
-    {
-
-        int jid = atoi(cmd[1]);
-        struct job *job1 = get_job_from_jid(jid);
-
-        job1->status = BACKGROUND;
-        killpg(job1->pgid, SIGCONT);
-
-        return 0;
     }
-    else if (strcmp(cmd[0], "stop") == 0)
+    /* When process terminated regularly (General case)
+        decrement the number of process alive*/
+    else if (WIFEXITED(status))
     {
-
-        int jid = atoi(cmd[1]);
-        struct job *job1 = get_job_from_jid(jid);
-        killpg(job1->pgid, SIGSTOP);
-        return 0;
+        /* If job is in FOREGRONG sample the last know good state
+            of terminal*/
+        if (job1->status == FOREGROUND && job_control)
+        {
+            termstate_sample();
+        }
+        if (job1->status == FOREGROUND && ent->slot == job1->num_pids - 1)
+        {
+            last_status = WEXITSTATUS(status);
+        }
+        process_terminated(job1, ent, ev);
     }
-    else if (strcmp(cmd[0], "jobs") == 0)
+    /*  When process get specific signal and terminated manually
+        Decrement the number of process alive */
+    else if (WIFSIGNALED(status))
     {
-        jobs();
-        return 0;
+        if (WTERMSIG(status) == SIGFPE)
+        {
+            printf("floating point exception\n");
+        }
+        if (WTERMSIG(status) == SIGSEGV)
+        {
+            printf("segmentation fault\n");
+        }
+        if (WTERMSIG(status) == SIGABRT)
+        {
+            printf("aborted\n");
+        }
+        if (WTERMSIG(status) == SIGKILL)
+        {
+            printf("killed\n");
+        }
+        if (WTERMSIG(status) == SIGTERM)
+        {
+            printf("terminated\n");
+        }
+        if (job1->status == FOREGROUND && ent->slot == job1->num_pids - 1)
+        {
+            last_status = 128 + WTERMSIG(status);
+        }
+        process_terminated(job1, ent, ev);
+    }
+}
+
+/* Set once the user typed EOF */
+static bool shell_done;
+
+/* True if stdin is a terminal and readline shows a prompt */
+static bool interactive;
+
+/* Saved input line while a notice is printed over the prompt */
+static char *saved_line;
+static int saved_point;
+
+/* Take the prompt and any partially typed line off the screen so
+ * that job notices can be printed in their place. */
+static void prompt_hide(void)
+{
+    saved_point = rl_point;
+    saved_line = rl_copy_text(0, rl_end);
+    rl_save_prompt();
+    rl_replace_line("", 0);
+    rl_redisplay();
+}
+
+/* Redraw the prompt and the partially typed line after prompt_hide */
+static void prompt_show(void)
+{
+    long long start = shell_stats_now();
+    fflush(stdout);
+    rl_restore_prompt();
+    rl_replace_line(saved_line, 0);
+    rl_point = saved_point;
+    rl_redisplay();
+    free(saved_line);
+    shell_stats_since(STAT_PROMPT, start);
+}
+
+/* Set the prompt readline shows for the next line.
+ * Do not output a prompt unless shell's stdin is a terminal */
+static void set_prompt(void)
+{
+    trace_flush();
+    long long start = shell_stats_now();
+    char *prompt = interactive ? build_prompt() : NULL;
+    rl_set_prompt(prompt);
+    free(prompt);
+    shell_stats_since(STAT_PROMPT, start);
+}
+
+/* Called by readline with each line the user entered,
+ * or NULL when the user typed EOF. */
+static void handle_line(char *cmdline)
+{
+    clean_joblist();
+    start_queued_jobs();
+
+    if (cmdline == NULL) /* User typed EOF */
+    {
+        shell_done = true;
+        rl_callback_handler_remove();
+        return;
+    }
+
+    // Only handling the line counts as parse time, not the job
+    // notices and queued jobs above
+    long long start = shell_stats_now();
+
+    // Checks for event discriptors for history and adds command to history
+    char *eventCheck;
+    history_expand(cmdline, &eventCheck);
+    if (strstr(cmdline, "!") || strstr(cmdline, "^"))
+    {
+        add_history(eventCheck);
+        cmdline = eventCheck;
+    }
+    else
+    {
+        add_history(cmdline);
+    }
+
+    /* The scanner works on the line in place; it only needs a second
+     * terminating '\0', which usually fits into the existing block. */
+    size_t len = strlen(cmdline);
+    char *buf = realloc(cmdline, len + 2);
+    if (buf == NULL)
+        utils_fatal_error("realloc failed: ");
+    buf[len + 1] = '\0';
+
+    struct ast_command_line *cline = ast_parse_command_buffer(buf, len);
+    free(buf);
+    shell_stats_since(STAT_PARSE, start);
+    if (cline != NULL) /* NULL means error in command line */
+    {
+        line_parsed_ns = shell_stats_now();
+        // ast_command_line_print(cline);      /* Output a representation of
+        //  the entered command line */
+
+        run_command(cline);
+        line_parsed_ns = 0;
+
+        /* Free the command line.
+         * run_command takes every pipeline out of the command line and
+         * either hands it to a job or frees it, so this only drops the
+         * command line's reference to its arena.  Pipelines owned by
+         * jobs keep the arena alive until the job is deleted.
+         */
+        ast_command_line_free(cline);
+    }
+
+    /* The line may have freed a slot, e.g. with fg, or raised a limit */
+    start_queued_jobs();
+
+    /* If you fail this assertion, readline is about to read the next
+     * line without the shell having terminal ownership.
+     * This would lead to the suspension of your shell with SIGTTOU.
+     * Make sure that you call termstate_give_terminal_back_to_shell()
+     * before returning here on all paths.
+     */
+    assert(termstate_get_current_terminal_owner() == getpgrp());
+    set_prompt();
+}
+
+int main(int ac, char *av[])
+{
+    int opt;
+    char *command = NULL;
+
+    static const struct option long_options[] = {
+        {"trace", required_argument, NULL, 't'},
+        {NULL, 0, NULL, 0},
+    };
+
+    /* Process command-line arguments. See getopt(3) */
+    while ((opt = getopt_long(ac, av, "hc:", long_options, NULL)) > 0)
+    {
+        switch (opt)
+        {
+        case 'h':
+            usage(av[0]);
+            break;
+        case 'c':
+            command = optarg;
+            break;
+        case 't':
+            if (!trace_start(optarg))
+                utils_fatal_error("cannot open %s: ", optarg);
+            break;
+        }
+    }
+
+    list_init(&job_list);
+    list_init(&completed_jobs);
+    list_init(&run_queue);
+    register_builtins();
+    sigchld_fd = signal_fd(SIGCHLD);
+
+    /* Scripts and -c command lines run without readline, history,
+     * or the terminal. */
+    if (command != NULL)
+    {
+        run_script_text(command, strlen(command), true);
+        wait_for_run_queue();
+        return last_status;
+    }
+    if (optind < ac)
+    {
+        run_script(av[optind], true);
+        wait_for_run_queue();
+        return last_status;
+    }
+
+    termstate_init();
+    job_control = true;
+    // Sets up history
+    using_history();
+
+    /* The event loop waits for either input on the terminal or
+     * SIGCHLD.  Input is fed to readline one character at a time;
+     * it calls handle_line once a line is complete. */
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+        utils_fatal_error("epoll_create1 failed: ");
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = sigchld_fd};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sigchld_fd, &ev) == -1)
+        utils_fatal_error("epoll_ctl failed: ");
+
+    /* epoll refuses regular files (cush < script); those are always
+     * readable, so just don't block when stdin is one. */
+    ev.data.fd = STDIN_FILENO;
+    bool stdin_pollable = epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0;
+    if (!stdin_pollable && errno != EPERM)
+        utils_fatal_error("epoll_ctl failed: ");
+
+    assert(termstate_get_current_terminal_owner() == getpgrp());
+    interactive = isatty(0);
+    char *prompt = interactive ? build_prompt() : NULL;
+    rl_callback_handler_install(prompt, handle_line);
+    free(prompt);
+
+    while (!shell_done)
+    {
+        /* Load and memory pressure change on their own, so while they
+         * hold back queued jobs, look at them again every second */
+        int timeout = -1;
+        if (!stdin_pollable)
+            timeout = 0;
+        else if (!list_empty(&run_queue) && admission_polls())
+            timeout = 1000;
+
+        struct epoll_event events[2];
+        int n = epoll_wait(epfd, events, 2, timeout);
+        if (n == -1 && errno != EINTR)
+            utils_fatal_error("epoll_wait failed: ");
+
+        bool input_ready = !stdin_pollable;
+        bool admit = n == 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == STDIN_FILENO)
+            {
+                input_ready = true;
+            }
+            else
+            {
+                /* Print notices for the whole batch of child events
+                 * at once, then redraw what the user was typing.  Reap
+                 * first so the prompt stays put if there is nothing. */
+                child_ring_reap(-1, WUNTRACED | WNOHANG);
+                bool notices = interactive && child_ring_pending();
+                if (notices)
+                    prompt_hide();
+                reap_children();
+                clean_joblist();
+                if (notices)
+                    prompt_show();
+                admit = true;
+            }
+        }
+
+        /* Jobs that finished may have made room for queued ones */
+        if (admit && run_queue_ready())
+        {
+            if (interactive)
+                prompt_hide();
+            start_queued_jobs();
+            if (interactive)
+                prompt_show();
+        }
+
+        if (input_ready)
+            rl_callback_read_char();
+    }
+    return 0;
+}
+
+/* Spawn the processes of a job in the foreground or background,
+ * whichever its status says.  A parallel job starts as many of its
+ * commands as it may run at once. */
+static void job_start(struct job *job)
+{
+    if (job->queue != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &job->started);
+        parallel_fill(job);
+        if (job_control && job->status == BACKGROUND && job->num_pids > 0)
+        {
+            printf("[%d] %d\n", job->jid, job->pgid);
+        }
+        job_check_done(job);
+        return;
+    }
+
+    struct ast_pipeline *pipe = job->pipe;
+    int size = list_size(&pipe->commands);
+    int count = 0;
+    sigset_t child_sigmask;
+    sigemptyset(&child_sigmask);
+
+    /* One set of attributes serves the whole pipeline: the spawn
+       library puts the first stage into a new process group,
+       lets it take the terminal, and has the others join it. */
+    posix_spawnattr_t posix_attr;
+    posix_spawnattr_init(&posix_attr);
+    // The shell keeps SIGCHLD blocked; its children must not inherit that
+    posix_spawnattr_setsigmask(&posix_attr, &child_sigmask);
+    if (!job_control)
+    {
+        // Without job control every job stays in the shell's process group
+        posix_spawnattr_setflags(&posix_attr, POSIX_SPAWN_SETSIGMASK);
+    }
+    else if (job->status == FOREGROUND)
+    {
+        posix_spawnattr_setflags(&posix_attr, POSIX_SPAWN_TCSETPGROUP | POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+        posix_spawnattr_tcsetpgrp_np(&posix_attr, termstate_get_tty_fd());
+    }
+    else
+    {
+        posix_spawnattr_setflags(&posix_attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+        posix_spawnattr_setpgroup(&posix_attr, 0);
+    }
+
+    /* Redirections only apply to the first and the last stage, so
+       they get file actions of their own.  Stages in between only
+       need actions for |&, and those are the same for all of them. */
+    posix_spawn_file_actions_t first_actions, last_actions, dup_actions;
+    posix_spawn_file_actions_init(&first_actions);
+    posix_spawn_file_actions_init(&last_actions);
+    posix_spawn_file_actions_init(&dup_actions);
+    posix_spawn_file_actions_adddup2(&dup_actions, STDOUT_FILENO, STDERR_FILENO);
+
+    posix_spawn_stage_t *stages = calloc(size, sizeof *stages);
+    if (stages == NULL)
+        utils_fatal_error("cannot allocate pipeline: ");
+
+    for (struct list_elem *e = list_begin(&pipe->commands);
+         e != list_end(&pipe->commands);
+         e = list_next(e))
+    {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        char **p = cmd->argv;
+        posix_spawn_stage_t *stage = &stages[count];
+        posix_spawn_file_actions_t *file_action = NULL;
+        if (count == size - 1)
+        {
+            file_action = &last_actions;
+        }
+        else if (count == 0)
+        {
+            file_action = &first_actions;
+        }
+
+        // If not null first command should read from file iored_input
+        if (count == 0 && pipe->iored_input)
+        {
+            posix_spawn_file_actions_addopen(file_action, STDIN_FILENO, pipe->iored_input, O_RDONLY, 0);
+        }
+        // If not null last command should write to file iored_output
+        if (count == size - 1 && pipe->iored_output)
+        {
+            if (pipe->append_to_output)
+            {
+                posix_spawn_file_actions_addopen(file_action, STDOUT_FILENO, pipe->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                posix_spawn_file_actions_addopen(file_action, STDERR_FILENO, pipe->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            }
+            else
+            {
+                posix_spawn_file_actions_addopen(file_action, STDOUT_FILENO, pipe->iored_output, O_CREAT | O_RDWR, 0666);
+            }
+        }
+
+        if (cmd->dup_stderr_to_stdout)
+        {
+            if (file_action != NULL)
+            {
+                posix_spawn_file_actions_adddup2(file_action, STDOUT_FILENO, STDERR_FILENO);
+            }
+            else
+            {
+                file_action = &dup_actions;
+            }
+            printf("  stderr shall also be redirected\n");
+        }
+
+        // Spawn from the cached path if there is one, so the child
+        // does not have to try each PATH directory in turn.  The path
+        // is copied: a later stage's lookup may free the cache's string
+        // before the stages are all spawned together below.
+        const char *path = NULL;
+        const struct builtin *builtin = builtin_lookup(p[0]);
+        if (builtin != NULL)
+        {
+            stage->fn = builtin->caps & BUILTIN_PIPELINE ? run_builtin_stage : refuse_builtin_stage;
+        }
+        else if (strchr(p[0], '/') == NULL && (path = path_cache_lookup(p[0])) != NULL)
+        {
+            path = arena_strdup(pipe->arena, path);
+        }
+        stage->file = path != NULL ? path : p[0];
+        stage->use_path = path == NULL;
+        stage->argv = p;
+        stage->file_actions = file_action;
+        count++;
+    }
+
+    // Anything the shell printed must come before the job's output,
+    // and must not be printed again by builtin stages
+    fflush(stdout);
+    starting_job = job;
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    if (line_parsed_ns != 0)
+    {
+        shell_stats_since(STAT_SPAWN, line_parsed_ns);
+        line_parsed_ns = 0;
+    }
+    posix_spawn_pipeline_np(stages, size, &posix_attr, environ);
+    starting_job = NULL;
+
+    for (int i = 0; i < size; i++)
+    {
+        if (stages[i].error != 0)
+        {
+            printf("no such file or directory\n");
+            if (i == size - 1)
+            {
+                last_status = 127;
+            }
+            continue;
+        }
+        if (job->num_pids == 0)
+        {
+            job->pgid = job_control ? stages[i].pid : getpgrp();
+            if (job_control && job->status == BACKGROUND)
+            {
+                printf("[%d] %d\n", job->jid, stages[i].pid);
+            }
+        }
+        job_add_process(job, &stages[i]);
+    }
+
+    /* The first stage took the terminal as it was spawned */
+    if (trace_enabled() && job_control && job->status == FOREGROUND && job->num_pids > 0)
+    {
+        char args[32];
+        snprintf(args, sizeof args, "{\"pgrp\":%d}", job->pgid);
+        trace_instant(getpid(), "terminal", stages[0].spawn_start_ns, args);
+    }
+
+    free(stages);
+    posix_spawn_file_actions_destroy(&first_actions);
+    posix_spawn_file_actions_destroy(&last_actions);
+    posix_spawn_file_actions_destroy(&dup_actions);
+    posix_spawnattr_destroy(&posix_attr);
+
+    /* Nothing was spawned, so no child will ever complete this job */
+    if (job->num_pids == 0)
+    {
+        job_completed(job);
+    }
+}
+
+/* Based on the parsing that was handled in main, this function run commands.
+    First loop takes the pipe lines out of the command line one by one.
+        after that this function determine if the pipe is built in or not
+
+        If built ins, built in functions are runned and the pipe is freed
+
+        If pipe is not built in job is added to job list
+            Second for loop goes over all the commands in pipe line
+                for each command we check if input or output need to be redircted
+                and create pipeline if there are more than one commands in pipe
+                Process group is created before creating the child process
+                Close all the pipes if pipes were created
+                Wait for all processes in this job to complete, or for
+                    the job no longer to be in the foreground.
+                After all this give terminal back to shell
+*/
+void run_command(struct ast_command_line *command_line)
+{
+    while (!list_empty(&command_line->pipes))
+    {
+        struct ast_pipeline *pipe1 = list_entry(list_pop_front(&command_line->pipes), struct ast_pipeline, elem);
+
+        /* Expand the patterns in each command just before it runs, so
+           they see what earlier commands of the line created */
+        for (struct list_elem *e = list_begin(&pipe1->commands); e != list_end(&pipe1->commands); e = list_next(e))
+        {
+            glob_expand_command(pipe1->arena, list_entry(e, struct ast_command, elem));
+        }
+
+        struct list_elem *e = list_begin(&pipe1->commands);
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        char **p = cmd->argv;
+        struct job *job1 = NULL;
+        int builtint = 1;
+        int size1 = list_size(&pipe1->commands);
+
+        /* "time" in front of a pipeline reports what the whole
+           pipeline took once it is done */
+        bool timed = strcmp(p[0], "time") == 0 && p[1] != NULL;
+        if (timed)
+        {
+            for (char **q = p; *q != NULL; q++)
+                q[0] = q[1];
+        }
+
+        /* A builtin on its own runs in the shell, which saves a fork and
+           lets it change the shell's state.  One whose effect is only its
+           output runs in a child instead when it is a background job,
+           and so does any builtin in a pipeline. */
+        const struct builtin *builtin = builtin_lookup(p[0]);
+        if (size1 == 1 && builtin != NULL && (!pipe1->bg_job || !(builtin->caps & BUILTIN_PIPELINE)))
+        {
+            if (timed)
+            {
+                builtint = time_builtin(pipe1, cmd, builtin);
+            }
+            else
+            {
+                builtint = run_builtin(pipe1, cmd, builtin);
+            }
+        }
+
+        /* Nothing is left for the shell to do after the last command
+           of a script, so let that command take the shell's place,
+           unless it is timed or jobs in the run queue still wait for it. */
+        if (builtint == 1 && exec_last_command && list_empty(&command_line->pipes) && !pipe1->bg_job && size1 == 1 &&
+            !timed && !trace_enabled() && list_empty(&run_queue))
+        {
+            exec_command(pipe1);
+        }
+
+        if (builtint == 1)
+        {
+            job1 = add_job(pipe1);
+            job1->pid_list = malloc(size1 * sizeof *job1->pid_list);
+            job1->pidfd_list = malloc(size1 * sizeof *job1->pidfd_list);
+            job1->usage_list = calloc(size1, sizeof *job1->usage_list);
+            if (job1->pid_list == NULL || job1->pidfd_list == NULL || job1->usage_list == NULL)
+                utils_fatal_error("cannot allocate pid list: ");
+            job1->timed = timed;
+
+            if (!pipe1->bg_job)
+            {
+                job_set_status(job1, FOREGROUND);
+            }
+            else if (!job_admit(job1))
+            {
+                continue;
+            }
+            job_start(job1);
+            wait_for_job(job1);
+            if (job_control)
+            {
+                termstate_give_terminal_back_to_shell();
+            }
+        }
+        else
+        {
+            ast_pipeline_free(pipe1);
+        }
+    }
+}
+
+/* Open 'path' and make it file descriptor 'fd' of the shell.  If
+ * 'saved' is not NULL, first keep a copy of the old 'fd' in saved[fd]. */
+static bool redirect_fd(int fd, const char *path, int flags, mode_t mode, int saved[3])
+{
+    int newfd = open(path, flags, mode);
+    if (newfd == -1)
+        return false;
+    if (saved != NULL && saved[fd] == -1)
+    {
+        saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    }
+    if (newfd != fd)
+    {
+        dup2(newfd, fd);
+        close(newfd);
+    }
+    return true;
+}
+
+/* Apply the redirections of 'pipe', whose only command is 'cmd', to
+ * the shell's own stdin, stdout and stderr, the same way run_command
+ * applies them through file actions.  If 'saved' is not NULL, the
+ * old fds are kept there for restore_redirections(). */
+static bool apply_redirections(struct ast_pipeline *pipe, struct ast_command *cmd, int saved[3])
+{
+    bool ok = true;
+    if (pipe->iored_input)
+    {
+        ok = redirect_fd(STDIN_FILENO, pipe->iored_input, O_RDONLY, 0, saved);
+    }
+    if (ok && pipe->iored_output)
+    {
+        if (pipe->append_to_output)
+        {
+            ok = redirect_fd(STDOUT_FILENO, pipe->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0644, saved) &&
+                 redirect_fd(STDERR_FILENO, pipe->iored_output, O_WRONLY | O_CREAT | O_APPEND, 0644, saved);
+        }
+        else
+        {
+            ok = redirect_fd(STDOUT_FILENO, pipe->iored_output, O_CREAT | O_RDWR, 0666, saved);
+        }
+    }
+    if (ok && cmd->dup_stderr_to_stdout)
+    {
+        if (saved != NULL && saved[STDERR_FILENO] == -1)
+        {
+            saved[STDERR_FILENO] = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+        }
+        dup2(STDOUT_FILENO, STDERR_FILENO);
+    }
+    return ok;
+}
+
+/* Put back the fds apply_redirections() saved */
+static void restore_redirections(int saved[3])
+{
+    for (int fd = 0; fd < 3; fd++)
+    {
+        if (saved[fd] != -1)
+        {
+            dup2(saved[fd], fd);
+            close(saved[fd]);
+        }
+    }
+}
+
+/* Run 'builtin', the only command of 'pipe', in the shell with the
+ * pipeline's redirections applied for as long as it runs.  Returns 0,
+ * which tells run_command that nothing is left to spawn. */
+static int run_builtin(struct ast_pipeline *pipe, struct ast_command *cmd,
+                       const struct builtin *builtin)
+{
+    int saved[3] = {-1, -1, -1};
+    bool redirected = pipe->iored_input || pipe->iored_output || cmd->dup_stderr_to_stdout;
+
+    if (redirected && !(builtin->caps & BUILTIN_REDIRECT))
+    {
+        printf("%s: cannot redirect\n", cmd->argv[0]);
+        last_status = 1;
+        return 0;
+    }
+
+    fflush(stdout);
+    bool ok = apply_redirections(pipe, cmd, saved);
+    if (ok)
+    {
+        builtin_pipeline = pipe;
+        last_status = builtin->run(cmd->argv);
+        builtin_pipeline = NULL;
+        // It may have handed the terminal to a job
+        if (builtin->caps & BUILTIN_TERMINAL && job_control)
+        {
+            termstate_give_terminal_back_to_shell();
+        }
+    }
+    fflush(stdout);
+    restore_redirections(saved);
+    if (!ok)
+    {
+        printf("%s: cannot redirect\n", cmd->argv[0]);
+        last_status = 1;
+    }
+    return 0;
+}
+
+/* What was used between 'before' and 'after' */
+static struct proc_usage rusage_delta(const struct rusage *before, const struct rusage *after)
+{
+    return (struct proc_usage){
+        .utime = (after->ru_utime.tv_sec - before->ru_utime.tv_sec) + (after->ru_utime.tv_usec - before->ru_utime.tv_usec) / 1e6,
+        .stime = (after->ru_stime.tv_sec - before->ru_stime.tv_sec) + (after->ru_stime.tv_usec - before->ru_stime.tv_usec) / 1e6,
+        .maxrss = after->ru_maxrss,
+        .nvcsw = after->ru_nvcsw - before->ru_nvcsw,
+        .nivcsw = after->ru_nivcsw - before->ru_nivcsw,
+    };
+}
+
+/* Run a builtin like run_builtin, then report the time it took and
+ * the resources the shell, and the children it reaped, used meanwhile */
+static int time_builtin(struct ast_pipeline *pipe, struct ast_command *cmd,
+                        const struct builtin *builtin)
+{
+    struct timespec start;
+    struct rusage before, after, children_before, children_after;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    getrusage(RUSAGE_SELF, &before);
+    getrusage(RUSAGE_CHILDREN, &children_before);
+
+    int rc = run_builtin(pipe, cmd, builtin);
+
+    getrusage(RUSAGE_SELF, &after);
+    getrusage(RUSAGE_CHILDREN, &children_after);
+    struct proc_usage usage = rusage_delta(&before, &after);
+    struct proc_usage children = rusage_delta(&children_before, &children_after);
+    proc_usage_add(&usage, &children);
+    print_time(seconds_since(&start), &usage);
+    return rc;
+}
+
+/* Run a builtin as a stage of a pipeline.  This runs in a forked copy
+ * of the shell, with its stdin and stdout already connected to the
+ * pipeline, and returns the stage's exit status. */
+static int run_builtin_stage(char *const *argv)
+{
+    // The pipeline being started is not one of the jobs 'jobs' reports
+    if (starting_job != NULL)
+    {
+        list_remove(&starting_job->elem);
+    }
+    int status = builtin_lookup(argv[0])->run((char **) argv);
+    fflush(stdout);
+    return status;
+}
+
+/* Stand in for a builtin that must run in the shell, when it appears
+ * in a pipeline.  Runs in a child like run_builtin_stage. */
+static int refuse_builtin_stage(char *const *argv)
+{
+    fprintf(stderr, "%s: cannot run in a pipeline\n", argv[0]);
+    return 1;
+}
+
+/* Replace the shell with the only command of 'pipe', applying the
+ * same redirections run_command would apply through file actions. */
+static void exec_command(struct ast_pipeline *pipe)
+{
+    struct ast_command *cmd = list_entry(list_begin(&pipe->commands), struct ast_command, elem);
+
+    fflush(stdout);
+    bool ok = apply_redirections(pipe, cmd, NULL);
+
+    if (ok)
+    {
+        // The shell keeps SIGCHLD blocked; the command must not inherit that
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        execvp(cmd->argv[0], cmd->argv);
+    }
+    printf("no such file or directory\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Get the next line of a script that has something to run or an
+ * error to report; blank lines are skipped. */
+static bool next_script_line(struct script_parser *parser, struct parsed_line *line)
+{
+    while (script_parser_next(parser, line))
+    {
+        if (line->cline == NULL || !list_empty(&line->cline->pipes))
+            return true;
+        ast_command_line_free(line->cline);
+    }
+    return false;
+}
+
+/* Run the lines of a script held in text[0..len).  The script is
+ * parsed on worker threads, one per CPU, while the lines parsed so
+ * far run.  If exec_last is set, the last command of the script
+ * replaces the shell. */
+static void run_script_text(const char *text, size_t len, bool exec_last)
+{
+    struct script_parser *parser;
+    parser = script_parser_create(text, len, sysconf(_SC_NPROCESSORS_ONLN));
+    if (parser == NULL)
+        utils_fatal_error("cannot start script parser: ");
+
+    struct parsed_line line, next;
+    bool more = next_script_line(parser, &line);
+    while (more)
+    {
+        // Look ahead to find out whether this is the last line
+        bool last = !next_script_line(parser, &next);
+
+        if (line.error != NULL)
+            fprintf(stderr, "%s\n", line.error);
+
+        if (line.cline != NULL)
+        {
+            reap_children();
+            clean_joblist();
+            start_queued_jobs();
+            exec_last_command = exec_last && last;
+            run_command(line.cline);
+            exec_last_command = false;
+            ast_command_line_free(line.cline);
+        }
+        line = next;
+        more = !last;
+    }
+    script_parser_destroy(parser);
+}
+
+/* Start the jobs a script or -c command line left in the run queue
+ * as the running ones finish, so none is lost when the shell exits */
+static void wait_for_run_queue(void)
+{
+    while (!list_empty(&run_queue))
+    {
+        if (child_ring_reap(-1, WUNTRACED) == -1)
+        {
+            start_queued_jobs();
+            break;
+        }
+        drain_children();
+        clean_joblist();
+        start_queued_jobs();
+    }
+}
+
+/* Scripts that cannot be mapped, such as pipes, are read into a
+ * buffer that starts at this size and doubles as needed */
+#define SCRIPT_CHUNK (64 * 1024)
+
+/* Run a script that cannot be mapped, such as a pipe, as it arrives.
+ * The complete lines read so far run before the next read, so
+ * "producer | cush /dev/stdin" runs each line as the producer writes
+ * it.  Since the shell cannot know which line is last before EOF, no
+ * command replaces the shell here. */
+static void run_script_stream(int fd, const char *path)
+{
+    char *text = NULL;
+    size_t size = 0, len = 0;
+    for (;;)
+    {
+        if (len == size)
+        {
+            size = size ? 2 * size : SCRIPT_CHUNK;
+            text = realloc(text, size);
+            if (text == NULL)
+                utils_fatal_error("realloc failed: ");
+        }
+        ssize_t n = read(fd, text + len, size - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == -1)
+                utils_error("reading %s failed: ", path);
+            break;
+        }
+
+        // Run up to the last newline; keep a partial line for later
+        char *nl = memrchr(text + len, '\n', n);
+        len += n;
+        if (nl == NULL)
+            continue;
+        size_t complete = nl - text + 1;
+        run_script_text(text, complete, false);
+        memmove(text, text + complete, len - complete);
+        len -= complete;
+    }
+    if (len > 0)
+        run_script_text(text, len, false);
+    free(text);
+}
+
+/* Run the commands in a script file.  Regular files are mapped
+ * into memory, anything else runs as it is read. */
+static void run_script(const char *path, bool exec_last)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        printf("%s: cannot open script\n", path);
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+
+    if (!S_ISREG(st.st_mode))
+    {
+        run_script_stream(fd, path);
+        close(fd);
+        return;
+    }
+
+    char *text = NULL;
+    size_t len = st.st_size;
+    if (len > 0)
+    {
+        text = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED)
+            utils_fatal_error("mmap failed: ");
+    }
+    close(fd);
+
+    run_script_text(text, len, exec_last);
+
+    if (text != NULL)
+        munmap(text, len);
+}
+
+/* Print one entry of the command hash table */
+static void print_hash_entry(const char *name, const char *path, unsigned hits, void *arg)
+{
+    int *count = arg;
+    if ((*count)++ == 0)
+    {
+        printf("hits\tcommand\n");
+    }
+    printf("%4u\t%s\n", hits, path);
+}
+
+/* Print how the shell would run 'name' */
+static void print_type(const char *name)
+{
+    if (builtin_lookup(name) != NULL)
+    {
+        printf("%s is a shell builtin\n", name);
+        return;
+    }
+
+    const char *path;
+    if (strchr(name, '/') != NULL)
+    {
+        if (access(name, X_OK) == 0)
+        {
+            printf("%s is %s\n", name, name);
+            return;
+        }
+    }
+    else if ((path = path_cache_peek(name)) != NULL)
+    {
+        printf("%s is hashed (%s)\n", name, path);
+        return;
+    }
+    else if ((path = path_cache_lookup(name)) != NULL)
+    {
+        printf("%s is %s\n", name, path);
+        return;
+    }
+    printf("type: %s: not found\n", name);
+}
+
+/* The builtins below are registered from builtins.def.  Each returns
+ * its exit status. */
+
+static int builtin_kill(char **cmd)
+{
+    int jid = atoi(cmd[1]);
+    struct job *job1 = get_job_from_jid(jid);
+
+    if (job1 == NULL)
+    {
+        printf("the process was not killed \n");
+        return 1;
+    }
+    if (job1->status == QUEUED)
+    {
+        // It never ran, so it only has to leave the queue
+        list_remove(&job1->queue_elem);
+        job_completed(job1);
+        return 0;
+    }
+    job_signal(job1, SIGTERM);
+    return 0;
+}
+
+/* The job 'fg' or 'bg' is to continue, or NULL if there is none left */
+static struct job *job_to_continue(char **cmd)
+{
+    int jid = cmd[1] != NULL ? atoi(cmd[1]) : 0;
+    struct job *job1 = get_job_from_jid(jid);
+    if (job1 == NULL || job1->completed)
+    {
+        printf("%s: no such job\n", cmd[0]);
+        return NULL;
+    }
+    return job1;
+}
+
+static int builtin_fg(char **cmd)
+{
+    struct job *job1 = job_to_continue(cmd);
+    if (job1 == NULL)
+    {
+        return 1;
+    }
+    print_cmdline(job1->pipe);
+    printf("\n");
+    if (job1->status == QUEUED)
+    {
+        // A queued job skips the queue and starts in the foreground
+        job_dequeue(job1, FOREGROUND);
+        wait_for_job(job1);
+        return last_status;
+    }
+    job_set_status(job1, FOREGROUND);
+    if (!job_control)
+    {
+        // No terminal to hand over
+    }
+    else if (job1->num_processes_alive == 0)
+    {
+        // A parallel job between commands; the next one takes the terminal
+    }
+    else if (job1->saved_state_changed == false)
+    {
+        termstate_give_terminal_to(NULL, job1->pgid);
+    }
+    else
+    {
+        termstate_give_terminal_to(&job1->saved_tty_state, job1->pgid);
+    }
+    job_signal(job1, SIGCONT);
+    if (job1->queue != NULL)
+    {
+        parallel_fill(job1);
+        job_check_done(job1);
+    }
+    wait_for_job(job1);
+    return last_status;
+}
+
+static int builtin_bg(char **cmd)
+{
+    struct job *job1 = job_to_continue(cmd);
+    if (job1 == NULL)
+    {
+        return 1;
+    }
+
+    if (job1->status == QUEUED)
+    {
+        // Start it now, whatever the limits say
+        job_dequeue(job1, BACKGROUND);
+        return 0;
+    }
+    job_set_status(job1, BACKGROUND);
+    job_signal(job1, SIGCONT);
+    if (job1->queue != NULL)
+    {
+        parallel_fill(job1);
+        job_check_done(job1);
+    }
+    return 0;
+}
+
+static int builtin_stop(char **cmd)
+{
+    int jid = atoi(cmd[1]);
+    struct job *job1 = get_job_from_jid(jid);
+    job_signal(job1, SIGSTOP);
+    return 0;
+}
+
+static int builtin_jobs(char **cmd)
+{
+    if (cmd[1] != NULL && strcmp(cmd[1], "-l") == 0)
+    {
+        for (struct list_elem *e = list_begin(&job_list);
+             e != list_end(&job_list);
+             e = list_next(e))
+        {
+            struct job *jobber = list_entry(e, struct job, elem);
+            print_job(jobber);
+            print_job_usage(jobber);
+        }
+        return 0;
+    }
+    jobs();
+    return 0;
+}
+
+/* Build a work queue from the arguments of a builtin with 'create',
+ * which may read stdin, and run it as one job of the builtin's
+ * pipeline.  Returns the job's exit status, or 0 if it runs in the
+ * background. */
+static int run_queue_builtin(char **cmd, struct parallel_queue *(*create)(char **, FILE *))
+{
+    struct ast_pipeline *pipe = builtin_pipeline;
+    FILE *input = fdopen(dup(STDIN_FILENO), "r");
+    if (input == NULL)
+    {
+        fprintf(stderr, "%s: cannot read stdin: %s\n", cmd[0], strerror(errno));
+        return 1;
+    }
+    struct parallel_queue *queue = create(cmd, input);
+    fclose(input);
+    if (queue == NULL)
+        return 2;
+
+    /* The job keeps the pipeline and the words of 'cmd' after
+       run_command has let go of them */
+    arena_retain(pipe->arena);
+    struct job *job = add_job(pipe);
+    int size = queue->ntasks > 0 ? queue->ntasks : 1;
+    job->queue = queue;
+    job->pid_list = malloc(size * sizeof *job->pid_list);
+    job->pidfd_list = malloc(size * sizeof *job->pidfd_list);
+    job->usage_list = calloc(size, sizeof *job->usage_list);
+    if (job->pid_list == NULL || job->pidfd_list == NULL || job->usage_list == NULL)
+        utils_fatal_error("cannot allocate pid list: ");
+
+    last_status = 0;
+    if (!pipe->bg_job)
+    {
+        job_set_status(job, FOREGROUND);
+    }
+    else if (!job_admit(job))
+    {
+        return 0;
     }
-    else if (strcmp(cmd[0], "exit") == 0)
+    job_start(job);
+    if (job->status == FOREGROUND)
+    {
+        wait_for_job(job);
+    }
+    return last_status;
+}
+
+/* parallel [-j N] [-g] command... [::: argument...] runs the command
+ * once per argument, N at a time, as one job.  Without ::: the
+ * arguments are read from stdin, one per line. */
+static int builtin_parallel(char **cmd)
+{
+    return run_queue_builtin(cmd, parallel_queue_create);
+}
+
+/* batch [-j N] [-n max] [-s bytes] command... [::: word...] runs the
+ * command with as many words at a time as fit into its arguments, like
+ * xargs, N commands at a time.  Without ::: the words are read from
+ * stdin. */
+static int builtin_batch(char **cmd)
+{
+    return run_queue_builtin(cmd, parallel_queue_create_batch);
+}
+
+/* queue [-j N] [-l load] [-m pressure] [-p priority jid] sets the
+ * limits of admission control for background jobs and the priority
+ * of a queued job.  Without arguments it prints the limits and the
+ * queued jobs in the order they will start. */
+static int builtin_queue(char **cmd)
+{
+    if (cmd[1] == NULL)
     {
-        exit(0);
+        admission_print(stdout);
+        for (struct list_elem *e = list_begin(&run_queue); e != list_end(&run_queue); e = list_next(e))
+        {
+            struct job *job = list_entry(e, struct job, queue_elem);
+            printf("[%d]\t%d\t\t(", job->jid, job->priority);
+            print_cmdline(job->pipe);
+            printf(")\n");
+        }
         return 0;
     }
-    else if (strcmp(cmd[0], "cd") == 0)
+
+    for (char **arg = cmd + 1; *arg != NULL; arg++)
     {
-        if (cmd[1] == NULL)
+        if (strcmp(arg[0], "-j") == 0 && arg[1] != NULL)
+        {
+            admission_limits.max_jobs = atoi(*++arg);
+        }
+        else if (strcmp(arg[0], "-l") == 0 && arg[1] != NULL)
+        {
+            admission_limits.max_load = atof(*++arg);
+        }
+        else if (strcmp(arg[0], "-m") == 0 && arg[1] != NULL)
+        {
+            admission_limits.max_pressure = atof(*++arg);
+        }
+        else if (strcmp(arg[0], "-p") == 0 && arg[1] != NULL && arg[2] != NULL)
         {
-            chdir(getenv("HOME"));
+            struct job *job = get_job_from_jid(atoi(arg[2]));
+            if (job == NULL || job->status != QUEUED)
+            {
+                printf("queue: %s: no such queued job\n", arg[2]);
+                return 1;
+            }
+            list_remove(&job->queue_elem);
+            job->priority = atoi(arg[1]);
+            run_queue_insert(job);
+            arg += 2;
         }
-        else if (chdir(cmd[1]) == -1)
+        else
         {
-            printf("Failed to change directory\n");
+            printf("queue: usage: queue [-j jobs] [-l load] [-m pressure] [-p priority jid]\n");
+            return 2;
         }
+    }
+    return 0;
+}
+
+/* stats prints the shell's latency histograms, stats -o file writes
+ * them to file as JSON, and stats -r starts over. */
+static int builtin_stats(char **cmd)
+{
+    if (cmd[1] == NULL)
+    {
+        shell_stats_print(stdout);
+        return 0;
+    }
+    if (strcmp(cmd[1], "-r") == 0 && cmd[2] == NULL)
+    {
+        shell_stats_reset();
         return 0;
     }
-    else if (strcmp(cmd[0], "history") == 0)
+    if (strcmp(cmd[1], "-o") == 0 && cmd[2] != NULL && cmd[3] == NULL)
     {
-        HISTORY_STATE *state = history_get_history_state();
+        FILE *out = fopen(cmd[2], "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "stats: cannot open %s: %s\n", cmd[2], strerror(errno));
+            return 1;
+        }
+        shell_stats_dump(out);
+        fclose(out);
+        return 0;
+    }
+    fprintf(stderr, "usage: stats [-r | -o file]\n");
+    return 2;
+}
 
-        // Print all of history entries to terminal
-        for (int idx = 0; idx < state->length; idx++)
+/* trace on [file] starts writing a trace of all jobs to file,
+ * cush-trace.json by default, and trace off finishes it. */
+static int builtin_trace(char **cmd)
+{
+    if (cmd[1] == NULL)
+    {
+        printf("trace is %s\n", trace_enabled() ? "on" : "off");
+        return 0;
+    }
+    if (strcmp(cmd[1], "on") == 0 && (cmd[2] == NULL || cmd[3] == NULL))
+    {
+        const char *path = cmd[2] != NULL ? cmd[2] : "cush-trace.json";
+        if (trace_enabled())
+        {
+            fprintf(stderr, "trace: already on\n");
+            return 1;
+        }
+        if (!trace_start(path))
         {
-            printf("%d %s \n", idx + 1, state->entries[idx]->line);
+            fprintf(stderr, "trace: cannot open %s: %s\n", path, strerror(errno));
+            return 1;
         }
         return 0;
     }
+    if (strcmp(cmd[1], "off") == 0 && cmd[2] == NULL)
+    {
+        trace_stop();
+        return 0;
+    }
+    fprintf(stderr, "usage: trace [on [file] | off]\n");
+    return 2;
+}
 
-    return 1;
+/* "time pipeline" is handled by run_command.  On its own, time
+ * reports the CPU time used by the shell and by its reaped children. */
+static int builtin_time(char **cmd)
+{
+    if (cmd[1] != NULL)
+    {
+        fprintf(stderr, "time: can only time a whole pipeline\n");
+        return 2;
+    }
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    printf("shell    user %ld.%03lds sys %ld.%03lds\n",
+           (long)self.ru_utime.tv_sec, (long)self.ru_utime.tv_usec / 1000,
+           (long)self.ru_stime.tv_sec, (long)self.ru_stime.tv_usec / 1000);
+    printf("children user %ld.%03lds sys %ld.%03lds\n",
+           (long)children.ru_utime.tv_sec, (long)children.ru_utime.tv_usec / 1000,
+           (long)children.ru_stime.tv_sec, (long)children.ru_stime.tv_usec / 1000);
+    return 0;
+}
+
+static int builtin_exit(char **cmd)
+{
+    exit(0);
+}
+
+static int builtin_cd(char **cmd)
+{
+    if (cmd[1] == NULL)
+    {
+        chdir(getenv("HOME"));
+    }
+    else if (chdir(cmd[1]) == -1)
+    {
+        printf("Failed to change directory\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int builtin_hash(char **cmd)
+{
+    int status = 0;
+    if (cmd[1] == NULL)
+    {
+        int count = 0;
+        path_cache_foreach(print_hash_entry, &count);
+        if (count == 0)
+        {
+            printf("hash: hash table empty\n");
+        }
+    }
+    else if (strcmp(cmd[1], "-r") == 0)
+    {
+        path_cache_clear();
+    }
+    else
+    {
+        // Look up each name now so later uses find it in the table
+        for (char **name = cmd + 1; *name != NULL; name++)
+        {
+            if (strchr(*name, '/') == NULL && path_cache_lookup(*name) == NULL)
+            {
+                printf("hash: %s: not found\n", *name);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
+
+static int builtin_type(char **cmd)
+{
+    for (char **name = cmd + 1; *name != NULL; name++)
+    {
+        print_type(*name);
+    }
+    return 0;
+}
+
+static int builtin_set(char **cmd)
+{
+    if (cmd[1] == NULL)
+    {
+        printf("spawn\t%s\n", posix_spawn_backend_name_np());
+    }
+    else if (strcmp(cmd[1], "spawn") == 0 && cmd[2] != NULL)
+    {
+        if (posix_spawn_backend_np(cmd[2]) != 0)
+        {
+            printf("set: unknown spawn backend %s\n", cmd[2]);
+            return 1;
+        }
+    }
+    else
+    {
+        printf("set: usage: set [spawn clone-vfork|vfork|fork|clone3]\n");
+        return 2;
+    }
+    return 0;
+}
+
+static int builtin_source(char **cmd)
+{
+    if (cmd[1] == NULL)
+    {
+        printf("source: missing file name\n");
+        return 2;
+    }
+    run_script(cmd[1], false);
+    return last_status;
+}
+
+static int builtin_history(char **cmd)
+{
+    HISTORY_STATE *state = history_get_history_state();
+
+    // Print all of history entries to terminal
+    for (int idx = 0; idx < state->length; idx++)
+    {
+        printf("%d %s \n", idx + 1, state->entries[idx]->line);
+    }
+    return 0;
+}
+
+/* Register the builtins listed in builtins.def */
+static void register_builtins(void)
+{
+#define BUILTIN(name, fn, caps) builtin_register(name, fn, caps);
+#include "builtins.def"
+#undef BUILTIN
 }
 
 /*
@@ -719,7 +2354,7 @@ void jobs()
          e != list_end(&job_list);
          e = list_next(e))
     {
-       scl enable gcc-toolset-12 bash struct job *jobber = list_entry(e, struct job, elem);
+        struct job *jobber = list_entry(e, struct job, elem);
         print_job(jobber);
     }
 }
@@ -729,45 +2364,28 @@ void jobs()
 */
 struct job *find_job(pid_t pid)
 {
-    for (struct list_elem *e = list_begin(&job_list);
-         e != list_end(&job_list);
-         e = list_next(e))
-    {
-        struct job *job1 = list_entry(e, struct job, elem);
-        for (int i = 0; i < sizeof(job1->pid_list) / sizeof(pid); i++)
-        {
-            if ((job1->pid_list[i]) == pid)
-            {
-                return job1;
-            }
-        }
-    }
-    return NULL;
+    struct pid_index_entry *ent = pid_index_lookup(pid);
+    return ent != NULL ? ent->owner : NULL;
 }
 
 /*
-    This goes over job list and delete all the jobs that has no process alive (terminated)
+    This deletes all the jobs that have no process alive (terminated).
+    handle_child_status queues those jobs as their last process dies,
+    so only the jobs that actually finished are looked at.
+    Background jobs get a "Done" notice first.
 */
 void clean_joblist()
 {
-    struct job *arr[MAXJOBS];
-    int count = 0;
-    for (struct list_elem *e = list_begin(&job_list);
-         e != list_end(&job_list);
-         e = list_next(e))
+    while (!list_empty(&completed_jobs))
     {
-        struct job *jobber = list_entry(e, struct job, elem);
-
-        if (jobber->num_processes_alive == 0)
+        struct job *jobber = list_entry(list_pop_front(&completed_jobs), struct job, done_elem);
+        if (job_control && jobber->status != FOREGROUND && jobber->num_pids > 0)
         {
-            arr[count] = jobber;
-            count++;
+            printf("[%d]\tDone\t\t(", jobber->jid);
+            print_cmdline(jobber->pipe);
+            printf(")\n");
         }
-    }
-    for (int idx = 0; idx < count; idx++)
-    {
-        list_remove(&arr[idx]->pipe->elem);
-        list_remove(&arr[idx]->elem);
-        delete_job(arr[idx]);
+        list_remove(&jobber->elem);
+        delete_job(jobber);
     }
 }
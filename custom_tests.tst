@@ -1,2 +1,15 @@
 = Tests for Custom Features
 1 gback_glob_test.py
+1 test_long_pipeline.py
+1 test_source_script.py
+1 test_builtin_pipeline.py
+1 test_core_builtins.py
+1 test_time.py
+1 test_stats.py
+1 test_trace.py
+1 test_parallel.py
+1 test_admission.py
+1 test_batch.py
+1 test_glob.py
+1 test_hash.py
+1 test_job_signal.py
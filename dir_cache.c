@@ -0,0 +1,243 @@
+/*
+ * A cache of directory listings for pathname expansion.
+ *
+ * Directories are read with getdents64 into a 256K buffer, so a
+ * directory with 100k entries takes about a dozen system calls rather
+ * than the hundred readdir() makes with its 32K buffer.  The
+ * names are copied into one block per directory.  A listing is sorted
+ * the first time it is used again, not when it is read: a pattern
+ * that is expanded only once sorts just its matches, as glob(3) does,
+ * and one that is expanded again finds them in order.
+ *
+ * A listing is valid as long as stat() reports the same device, inode
+ * and mtime for the path; the inode also catches a relative path that
+ * now means another directory after cd.  The kernel takes file
+ * timestamps from a clock that only ticks every few milliseconds, so
+ * a directory changed twice within one tick keeps its mtime.  A
+ * listing read less than DIR_CACHE_RACY_NS after the directory's
+ * mtime is therefore not cached, as git does with its index.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "dir_cache.h"
+#include "utils.h"
+
+#define DIR_CACHE_SLOTS 64                  /* Directories kept at most */
+#define DIR_CACHE_MAX_BYTES (64 << 20)      /* Memory kept at most */
+#define DIR_CACHE_RACY_NS 20000000LL
+#define GETDENTS_BUFFER_SIZE (256 * 1024)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct cache_slot {
+    char *path;                 /* NULL if the slot is empty */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct dir_listing *listing;
+    unsigned long last_used;
+};
+
+/* Few enough that looking through all of them costs less than the
+ * stat() every lookup makes anyway */
+static struct cache_slot slots[DIR_CACHE_SLOTS];
+static size_t cached_bytes;
+static unsigned long uses;
+
+static void
+slot_clear(struct cache_slot *slot)
+{
+    cached_bytes -= slot->listing->size;
+    dir_listing_release(slot->listing);
+    free(slot->path);
+    *slot = (struct cache_slot) { .path = NULL };
+}
+
+void
+dir_listing_release(struct dir_listing *listing)
+{
+    if (--listing->refs > 0)
+        return;
+    free(listing->entries);
+    free(listing->names);
+    free(listing);
+}
+
+void
+dir_cache_clear(void)
+{
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++)
+        if (slots[i].path != NULL)
+            slot_clear(&slots[i]);
+}
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const struct dir_entry *x = a, *y = b;
+    return strcoll(x->name, y->name);
+}
+
+/* Grow '*p', which holds '*cap' elements of 'size' bytes, to hold at
+ * least 'need' */
+static void
+grow(void *p, size_t *cap, size_t need, size_t size)
+{
+    if (need <= *cap)
+        return;
+    size_t newcap = *cap ? *cap : 256;
+    while (newcap < need)
+        newcap *= 2;
+    void *q = realloc(*(void **) p, newcap * size);
+    if (q == NULL)
+        utils_fatal_error("cannot allocate directory listing: ");
+    *(void **) p = q;
+    *cap = newcap;
+}
+
+/* Read the directory that 'fd' refers to */
+static struct dir_listing *
+read_listing(int fd)
+{
+    static char buf[GETDENTS_BUFFER_SIZE] __attribute__((aligned(8)));
+    struct dir_listing *listing = calloc(1, sizeof *listing);
+    size_t *offsets = NULL, ncap = 0, ecap = 0, ocap = 0, len = 0;
+    if (listing == NULL)
+        utils_fatal_error("cannot allocate directory listing: ");
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof buf)) > 0) {
+        for (long pos = 0; pos < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) (buf + pos);
+            pos += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            size_t namelen = strlen(name) + 1;
+            grow(&listing->names, &ncap, len + namelen, 1);
+            grow(&listing->entries, &ecap, listing->count + 1, sizeof *listing->entries);
+            grow(&offsets, &ocap, listing->count + 1, sizeof *offsets);
+            memcpy(listing->names + len, name, namelen);
+            offsets[listing->count] = len;
+            listing->entries[listing->count++].type = d->d_type;
+            len += namelen;
+        }
+    }
+    if (n == -1) {
+        int saved_errno = errno;
+        free(offsets);
+        listing->refs = 1;
+        dir_listing_release(listing);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    /* The names only stay put once they are all in */
+    for (size_t i = 0; i < listing->count; i++)
+        listing->entries[i].name = listing->names + offsets[i];
+    free(offsets);
+    listing->size = len + listing->count * sizeof *listing->entries;
+    listing->refs = 1;
+    return listing;
+}
+
+/* The slot to put a new listing into: an empty one, or else the one
+ * used longest ago.  Also make room for 'size' more bytes. */
+static struct cache_slot *
+slot_for(size_t size)
+{
+    for (;;) {
+        struct cache_slot *oldest = NULL;
+        for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+            if (slots[i].path == NULL) {
+                if (cached_bytes + size <= DIR_CACHE_MAX_BYTES)
+                    return &slots[i];
+                continue;
+            }
+            if (oldest == NULL || slots[i].last_used < oldest->last_used)
+                oldest = &slots[i];
+        }
+        if (oldest == NULL)
+            return NULL;
+        slot_clear(oldest);
+    }
+}
+
+struct dir_listing *
+dir_cache_get(const char *path)
+{
+    struct stat st;
+    struct cache_slot *slot = NULL;
+    for (int i = 0; i < DIR_CACHE_SLOTS; i++) {
+        if (slots[i].path != NULL && strcmp(slots[i].path, path) == 0) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (slot != NULL) {
+        if (stat(path, &st) == 0 && st.st_dev == slot->dev && st.st_ino == slot->ino
+            && st.st_mtim.tv_sec == slot->mtime.tv_sec
+            && st.st_mtim.tv_nsec == slot->mtime.tv_nsec) {
+            slot->last_used = ++uses;
+            if (!slot->listing->sorted && slot->listing->refs == 1) {
+                if (slot->listing->count > 1)
+                    qsort(slot->listing->entries, slot->listing->count,
+                          sizeof *slot->listing->entries, compare_entries);
+                slot->listing->sorted = true;
+            }
+            slot->listing->refs++;
+            return slot->listing;
+        }
+        slot_clear(slot);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    struct dir_listing *listing = NULL;
+    if (fstat(fd, &st) == 0)
+        listing = read_listing(fd);
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    if (listing == NULL)
+        return NULL;
+
+    long long age = (now.tv_sec - st.st_mtim.tv_sec) * 1000000000LL
+                    + (now.tv_nsec - st.st_mtim.tv_nsec);
+    if (age < DIR_CACHE_RACY_NS || listing->size > DIR_CACHE_MAX_BYTES)
+        return listing;
+    if ((slot = slot_for(listing->size)) == NULL)
+        return listing;
+
+    slot->path = strdup(path);
+    if (slot->path == NULL)
+        utils_fatal_error("cannot allocate directory cache: ");
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->mtime = st.st_mtim;
+    slot->listing = listing;
+    slot->last_used = ++uses;
+    cached_bytes += listing->size;
+    listing->refs++;
+    return listing;
+}
@@ -0,0 +1,37 @@
+#ifndef __DIR_CACHE_H
+#define __DIR_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A cache of directory listings for pathname expansion.  A listing
+ * is used again as long as the directory has the same device, inode
+ * and mtime, so expanding a pattern in a large directory that did not
+ * change costs one stat() instead of reading the whole directory. */
+
+struct dir_entry {
+    const char *name;
+    unsigned char type;         /* DT_DIR, DT_REG, ..., or DT_UNKNOWN */
+};
+
+struct dir_listing {
+    struct dir_entry *entries;  /* Without . and .. */
+    size_t count;
+    bool sorted;                /* Entries are sorted with strcoll */
+    char *names;                /* Where the names are kept */
+    size_t size;                /* Bytes used by the listing */
+    int refs;
+};
+
+/* Return the listing of directory 'path', or NULL with errno set if it
+ * cannot be read.  It is sorted if it came from the cache.  Release it with dir_listing_release() when done;
+ * it stays valid until then even if the cache lets go of it. */
+struct dir_listing * dir_cache_get(const char *path);
+
+/* Drop a reference to a listing from dir_cache_get() */
+void dir_listing_release(struct dir_listing *listing);
+
+/* Forget all listings */
+void dir_cache_clear(void);
+
+#endif /* __DIR_CACHE_H */
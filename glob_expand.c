@@ -0,0 +1,459 @@
+/*
+ * Pathname expansion.
+ *
+ * A pattern is split at '/' into components, and each component is
+ * compiled once into a sequence of tokens: a character, '?', '*', or
+ * a bracket expression as a 256-bit set.  Matching a name then needs
+ * no parsing, and with the usual backtracking to the last '*' takes
+ * time linear in the name for the patterns people write.  Components
+ * without wildcards are not matched at all, only appended to the path.
+ *
+ * Directories come from dir_cache, which sorts a listing once it is
+ * used again.  If only the last component has wildcards and its
+ * listing is sorted, every match is one directory's entry appended to
+ * the same prefix, so the matches come out in order and need no sort.
+ * Otherwise they are sorted as whole pathnames, like glob(3) does.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <obstack.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "glob_expand.h"
+#include "dir_cache.h"
+#include "utils.h"
+
+#define obstack_chunk_alloc malloc
+#define obstack_chunk_free free
+
+enum token_kind { T_CHAR, T_ANY, T_STAR, T_SET };
+
+struct token {
+    enum token_kind kind;
+    unsigned char c;            /* T_CHAR */
+    uint64_t set[4];            /* T_SET: the bytes it matches */
+};
+
+struct component {
+    struct token *tokens;
+    int ntokens;
+    bool wild;                  /* Has '*', '?' or a bracket expression */
+    char *literal;              /* If not wild, the name with escapes removed */
+};
+
+struct pattern {
+    struct component *components;
+    int ncomponents;
+    bool absolute;
+    bool dirs_only;             /* The pattern ends in '/' */
+    int nwild;                  /* Components with wildcards */
+    int last_wild;              /* The last of them */
+};
+
+/* One expansion in progress */
+struct expansion {
+    struct pattern *pattern;
+    struct obstack paths;       /* The matches */
+    char **matches;
+    size_t nmatches, capacity;
+    char *path;                 /* The path built so far */
+    size_t pathcap;
+    bool unsorted;              /* Some listing was not sorted */
+};
+
+static void
+set_add(uint64_t set[4], unsigned char c)
+{
+    set[c >> 6] |= 1ULL << (c & 63);
+}
+
+static bool
+set_has(const uint64_t set[4], unsigned char c)
+{
+    return set[c >> 6] >> (c & 63) & 1;
+}
+
+static const struct {
+    const char *name;
+    int (*is)(int);
+} char_classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+/* Add the bytes in character class 'name' of length 'len' to 'set' */
+static bool
+add_class(uint64_t set[4], const char *name, size_t len)
+{
+    for (size_t i = 0; i < sizeof char_classes / sizeof char_classes[0]; i++) {
+        if (strlen(char_classes[i].name) != len || strncmp(char_classes[i].name, name, len) != 0)
+            continue;
+        for (int c = 1; c < 256; c++)
+            if (char_classes[i].is(c))
+                set_add(set, c);
+        return true;
+    }
+    return false;
+}
+
+/* Compile the bracket expression that starts at p[0] == '['.  Returns
+ * the end of it, or NULL if it is not one, in which case the '[' is
+ * an ordinary character. */
+static const char *
+compile_bracket(const char *p, const char *end, struct token *t)
+{
+    const char *q = p + 1;
+    bool negate = q < end && (*q == '!' || *q == '^');
+    if (negate)
+        q++;
+
+    memset(t->set, 0, sizeof t->set);
+    for (bool first = true; q < end && (first || *q != ']'); first = false) {
+        if (q[0] == '[' && q + 1 < end && q[1] == ':') {
+            const char *close = memmem(q + 2, end - q - 2, ":]", 2);
+            if (close != NULL && add_class(t->set, q + 2, close - q - 2)) {
+                q = close + 2;
+                continue;
+            }
+        }
+        unsigned char lo = *q++;
+        if (lo == '\\' && q < end)
+            lo = *q++;
+        unsigned char hi = lo;
+        if (q + 1 < end && q[0] == '-' && q[1] != ']') {
+            q++;
+            hi = *q++;
+            if (hi == '\\' && q < end)
+                hi = *q++;
+        }
+        for (int c = lo; c <= hi; c++)
+            set_add(t->set, c);
+    }
+    if (q >= end)
+        return NULL;
+
+    if (negate)
+        for (int i = 0; i < 4; i++)
+            t->set[i] = ~t->set[i];
+    t->set[0] &= ~1ULL;         /* Names never contain '\0' */
+    t->kind = T_SET;
+    return q + 1;
+}
+
+/* Compile the component in p[0..end) */
+static void
+compile_component(const char *p, const char *end, struct component *comp)
+{
+    comp->tokens = malloc((end - p) * sizeof *comp->tokens);
+    comp->literal = malloc(end - p + 1);
+    if (comp->tokens == NULL || comp->literal == NULL)
+        utils_fatal_error("cannot compile pattern: ");
+    comp->ntokens = 0;
+    comp->wild = false;
+
+    size_t len = 0;
+    while (p < end) {
+        struct token *t = &comp->tokens[comp->ntokens];
+        const char *next;
+        if (*p == '*') {
+            p++;
+            comp->wild = true;
+            if (comp->ntokens > 0 && t[-1].kind == T_STAR)
+                continue;
+            t->kind = T_STAR;
+        } else if (*p == '?') {
+            p++;
+            comp->wild = true;
+            t->kind = T_ANY;
+        } else if (*p == '[' && (next = compile_bracket(p, end, t)) != NULL) {
+            p = next;
+            comp->wild = true;
+        } else {
+            if (*p == '\\' && p + 1 < end)
+                p++;
+            t->kind = T_CHAR;
+            t->c = *p++;
+            comp->literal[len++] = t->c;
+        }
+        comp->ntokens++;
+    }
+    comp->literal[len] = '\0';
+}
+
+/* Compile 'text'.  Returns false if it has no wildcards. */
+static bool
+compile(const char *text, struct pattern *pat)
+{
+    size_t len = strlen(text);
+    pat->components = malloc((len / 2 + 1) * sizeof *pat->components);
+    if (pat->components == NULL)
+        utils_fatal_error("cannot compile pattern: ");
+    pat->ncomponents = 0;
+    pat->absolute = text[0] == '/';
+    pat->dirs_only = len > 0 && text[len - 1] == '/';
+    pat->nwild = 0;
+    pat->last_wild = -1;
+
+    for (const char *p = text; *p != '\0'; ) {
+        const char *slash = strchrnul(p, '/');
+        if (slash > p) {
+            struct component *comp = &pat->components[pat->ncomponents];
+            compile_component(p, slash, comp);
+            if (comp->wild) {
+                pat->nwild++;
+                pat->last_wild = pat->ncomponents;
+            }
+            pat->ncomponents++;
+        }
+        p = *slash == '/' ? slash + 1 : slash;
+    }
+    return pat->nwild > 0;
+}
+
+static void
+pattern_free(struct pattern *pat)
+{
+    for (int i = 0; i < pat->ncomponents; i++) {
+        free(pat->components[i].tokens);
+        free(pat->components[i].literal);
+    }
+    free(pat->components);
+}
+
+static bool
+token_matches(const struct token *t, unsigned char c)
+{
+    switch (t->kind) {
+    case T_CHAR:
+        return t->c == c;
+    case T_SET:
+        return set_has(t->set, c);
+    default:
+        return true;
+    }
+}
+
+/* Match 'name' against a compiled component.  On a mismatch after a
+ * '*', let that '*' take one more character and try again. */
+static bool
+match(const struct component *comp, const char *name)
+{
+    const struct token *t = comp->tokens;
+    int n = comp->ntokens, ti = 0, star = -1;
+    const char *star_name = NULL;
+
+    /* A leading '.' is only matched by a '.' in the pattern */
+    if (name[0] == '.' && (n == 0 || t[0].kind != T_CHAR))
+        return false;
+
+    while (*name != '\0') {
+        if (ti < n && t[ti].kind == T_STAR) {
+            star = ++ti;
+            star_name = name;
+        } else if (ti < n && token_matches(&t[ti], *name)) {
+            ti++;
+            name++;
+        } else if (star >= 0) {
+            ti = star;
+            name = ++star_name;
+        } else {
+            return false;
+        }
+    }
+    while (ti < n && t[ti].kind == T_STAR)
+        ti++;
+    return ti == n;
+}
+
+/* Make room for 'len' more bytes after the first 'used' of the path */
+static void
+path_reserve(struct expansion *x, size_t used, size_t len)
+{
+    if (used + len + 1 <= x->pathcap)
+        return;
+    while (x->pathcap < used + len + 1)
+        x->pathcap = x->pathcap ? 2 * x->pathcap : 256;
+    x->path = realloc(x->path, x->pathcap);
+    if (x->path == NULL)
+        utils_fatal_error("cannot expand pattern: ");
+}
+
+/* Append 'name' and, if 'slash', a '/' to the first 'used' bytes of
+ * the path.  Returns the new length. */
+static size_t
+path_append(struct expansion *x, size_t used, const char *name, bool slash)
+{
+    size_t len = strlen(name);
+    path_reserve(x, used, len + 1);
+    memcpy(x->path + used, name, len);
+    used += len;
+    if (slash)
+        x->path[used++] = '/';
+    x->path[used] = '\0';
+    return used;
+}
+
+static void
+add_match(struct expansion *x, size_t len)
+{
+    if (x->nmatches == x->capacity) {
+        x->capacity = x->capacity ? 2 * x->capacity : 64;
+        x->matches = realloc(x->matches, x->capacity * sizeof *x->matches);
+        if (x->matches == NULL)
+            utils_fatal_error("cannot expand pattern: ");
+    }
+    x->matches[x->nmatches++] = obstack_copy0(&x->paths, x->path, len);
+}
+
+/* True if 'path' names a directory.  'type' is what the directory
+ * listing said about it. */
+static bool
+is_directory(const char *path, unsigned char type)
+{
+    struct stat st;
+    if (type != DT_UNKNOWN && type != DT_LNK)
+        return type == DT_DIR;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Match components i.. below the directory in the first 'used' bytes
+ * of the path, which ends in '/' unless it is empty */
+static void
+walk(struct expansion *x, int i, size_t used)
+{
+    struct pattern *pat = x->pattern;
+
+    /* Components without wildcards just extend the path */
+    while (i < pat->ncomponents && !pat->components[i].wild) {
+        bool last = i == pat->ncomponents - 1;
+        used = path_append(x, used, pat->components[i].literal, !last || pat->dirs_only);
+        if (last) {
+            struct stat st;
+            if (pat->dirs_only ? stat(x->path, &st) == 0 && S_ISDIR(st.st_mode)
+                               : lstat(x->path, &st) == 0)
+                add_match(x, used);
+            return;
+        }
+        i++;
+    }
+
+    path_reserve(x, used, 0);
+    x->path[used] = '\0';
+    struct dir_listing *listing = dir_cache_get(used > 0 ? x->path : ".");
+    if (listing == NULL)
+        return;
+
+    const struct component *comp = &pat->components[i];
+    bool last = i == pat->ncomponents - 1;
+    x->unsorted |= !listing->sorted;
+    for (size_t e = 0; e < listing->count; e++) {
+        const struct dir_entry *ent = &listing->entries[e];
+        if (!match(comp, ent->name))
+            continue;
+        size_t len = path_append(x, used, ent->name, false);
+        if (last && !pat->dirs_only) {
+            add_match(x, len);
+        } else if (is_directory(x->path, ent->type)) {
+            len = path_append(x, len, "/", false);
+            if (last)
+                add_match(x, len);
+            else
+                walk(x, i + 1, len);
+        }
+    }
+    dir_listing_release(listing);
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcoll(*(char *const *) a, *(char *const *) b);
+}
+
+size_t
+glob_expand(const char *text, void (*fn)(const char *path, void *arg), void *arg)
+{
+    struct pattern pat;
+    if (!compile(text, &pat)) {
+        pattern_free(&pat);
+        return 0;
+    }
+
+    struct expansion x = { .pattern = &pat };
+    obstack_init(&x.paths);
+    walk(&x, 0, pat.absolute ? path_append(&x, 0, "/", false) : 0);
+
+    /* Names from one sorted listing behind the same prefix are in
+     * order, unless something follows them: "a/" sorts after "a-b/" */
+    if (x.nmatches > 1 && (x.unsorted || pat.nwild > 1
+                           || pat.last_wild != pat.ncomponents - 1 || pat.dirs_only))
+        qsort(x.matches, x.nmatches, sizeof *x.matches, compare_paths);
+
+    for (size_t m = 0; m < x.nmatches; m++)
+        fn(x.matches[m], arg);
+
+    size_t n = x.nmatches;
+    obstack_free(&x.paths, NULL);
+    free(x.matches);
+    free(x.path);
+    pattern_free(&pat);
+    return n;
+}
+
+/* The words of a command as they are expanded */
+struct word_list {
+    struct arena *arena;
+    char **words;
+    size_t n, capacity;
+};
+
+static void
+add_word(struct word_list *list, char *word)
+{
+    if (list->n == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 16;
+        list->words = realloc(list->words, list->capacity * sizeof *list->words);
+        if (list->words == NULL)
+            utils_fatal_error("cannot expand pattern: ");
+    }
+    list->words[list->n++] = word;
+}
+
+static void
+add_path(const char *path, void *arg)
+{
+    struct word_list *list = arg;
+    add_word(list, arena_strdup(list->arena, path));
+}
+
+void
+glob_expand_command(struct arena *arena, struct ast_command *cmd)
+{
+    if (cmd->patterns == NULL)
+        return;
+
+    struct word_list list = { .arena = arena };
+    char **pattern = cmd->patterns;
+    for (char **p = cmd->argv; *p != NULL; p++) {
+        if (*p == *pattern) {
+            pattern++;
+            if (glob_expand(*p, add_path, &list) > 0)
+                continue;
+        }
+        add_word(&list, *p);
+    }
+    add_word(&list, NULL);
+
+    cmd->argv = arena_alloc(arena, list.n * sizeof *cmd->argv);
+    memcpy(cmd->argv, list.words, list.n * sizeof *cmd->argv);
+    cmd->patterns = NULL;
+    free(list.words);
+}
@@ -0,0 +1,26 @@
+#ifndef __GLOB_EXPAND_H
+#define __GLOB_EXPAND_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "shell-ast.h"
+
+/* Pathname expansion (POSIX 2.13.3).  A pattern is compiled once,
+ * then matched against directory listings from dir_cache.  Wildcards
+ * do not match a leading '.', and the pathnames a pattern matches
+ * are sorted with strcoll, as glob(3) sorts them.  . and .. are never
+ * matched. */
+
+/* Call 'fn' with each pathname that matches 'pattern', in order.
+ * Returns the number of matches; 0 if the pattern has no wildcard
+ * or matches nothing. */
+size_t glob_expand(const char *pattern, void (*fn)(const char *path, void *arg),
+                   void *arg);
+
+/* Replace each word of 'cmd' that the parser marked as a pattern by
+ * the pathnames it matches, allocated from 'arena'.  A pattern that
+ * matches nothing stays as it is. */
+void glob_expand_command(struct arena *arena, struct ast_command *cmd);
+
+#endif /* __GLOB_EXPAND_H */
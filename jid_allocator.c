@@ -0,0 +1,66 @@
+/*
+ * Job id allocator.
+ *
+ * csh hands out the lowest job id that is not in use.  Rather than
+ * scanning the job table for a free slot, we keep a three-level
+ * bitmap of used ids.  A bit in a summary word is set when the
+ * word below it is completely used, so the lowest free id is found
+ * with one find-first-zero per level.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "jid_allocator.h"
+
+#define WORD_BITS 64
+#define NLEAVES (JID_LIMIT / WORD_BITS)         /* 1024 */
+#define NMIDS (NLEAVES / WORD_BITS)             /* 16 */
+
+_Static_assert(NMIDS <= WORD_BITS, "top level must fit in one word");
+
+/* A set bit means "in use" (leaf) or "entirely in use" (mid, top).
+ * Job id 0 is never handed out. */
+static uint64_t leaf[NLEAVES] = { 1 };
+static uint64_t mid[NMIDS];
+static uint64_t top;
+
+/* Index of the lowest clear bit in w.  w must not be all ones. */
+static inline int
+first_zero(uint64_t w)
+{
+    return __builtin_ctzll(~w);
+}
+
+int
+jid_alloc(void)
+{
+    int m = first_zero(top);
+    if (m >= NMIDS)
+        return -1;
+
+    int l = m * WORD_BITS + first_zero(mid[m]);
+    int jid = l * WORD_BITS + first_zero(leaf[l]);
+
+    leaf[l] |= 1ULL << (jid % WORD_BITS);
+    if (leaf[l] == UINT64_MAX) {
+        mid[m] |= 1ULL << (l % WORD_BITS);
+        if (mid[m] == UINT64_MAX)
+            top |= 1ULL << m;
+    }
+    return jid;
+}
+
+void
+jid_free(int jid)
+{
+    assert(jid > 0 && jid < JID_LIMIT);
+    int l = jid / WORD_BITS;
+    int m = l / WORD_BITS;
+
+    assert(leaf[l] & (1ULL << (jid % WORD_BITS)));
+    leaf[l] &= ~(1ULL << (jid % WORD_BITS));
+    mid[m] &= ~(1ULL << (l % WORD_BITS));
+    top &= ~(1ULL << m);
+}
@@ -0,0 +1,14 @@
+#ifndef __JID_ALLOCATOR_H
+#define __JID_ALLOCATOR_H
+
+/* Job ids are handed out from [1, JID_LIMIT) */
+#define JID_LIMIT (1 << 16)
+
+/* Return the lowest job id not currently in use, or -1 if all
+ * job ids are taken. */
+int jid_alloc(void);
+
+/* Return a job id obtained from jid_alloc so it can be reused */
+void jid_free(int jid);
+
+#endif /* __JID_ALLOCATOR_H */
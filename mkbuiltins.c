@@ -0,0 +1,80 @@
+/*
+ * mkbuiltins - generate builtin_hash.h from builtins.def
+ *
+ * Reads the BUILTIN("name", ...) lines on stdin and writes the seed
+ * and table size under which builtin_name_hash() maps every name to a
+ * different slot.  The table has at least twice as many slots as
+ * there are names, and grows if no seed up to MAX_SEEDS works.  A
+ * name listed twice can never get a slot of its own, so it is an
+ * error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "builtin_table.h"
+
+#define MAX_NAMES 1024
+#define MAX_SEEDS 1000000
+#define MAX_SIZE (64 * MAX_NAMES)
+
+static bool
+perfect(char **names, int n, uint32_t seed, uint32_t size)
+{
+    bool used[size];
+    memset(used, 0, sizeof used);
+    for (int i = 0; i < n; i++) {
+        uint32_t s = builtin_name_hash(names[i], seed) & (size - 1);
+        if (used[s])
+            return false;
+        used[s] = true;
+    }
+    return true;
+}
+
+int
+main(void)
+{
+    static char *names[MAX_NAMES];
+    char line[1024];
+    int n = 0;
+
+    while (fgets(line, sizeof line, stdin) != NULL) {
+        char *start = strstr(line, "BUILTIN(\"");
+        if (start != line)
+            continue;
+        start += strlen("BUILTIN(\"");
+        char *end = strchr(start, '"');
+        if (end == NULL || n == MAX_NAMES) {
+            fprintf(stderr, "mkbuiltins: bad line: %s", line);
+            return EXIT_FAILURE;
+        }
+        names[n] = strndup(start, end - start);
+        for (int i = 0; i < n; i++) {
+            if (strcmp(names[i], names[n]) == 0) {
+                fprintf(stderr, "mkbuiltins: %s is listed twice\n", names[n]);
+                return EXIT_FAILURE;
+            }
+        }
+        n++;
+    }
+
+    uint32_t size = 1;
+    while (size < 2 * (uint32_t) n)
+        size *= 2;
+
+    for (; size <= MAX_SIZE; size *= 2) {
+        for (uint32_t seed = 0; seed < MAX_SEEDS; seed++) {
+            if (!perfect(names, n, seed, size))
+                continue;
+            printf("/* Generated by mkbuiltins from builtins.def, do not edit */\n"
+                   "#define BUILTIN_HASH_SEED %uu\n"
+                   "#define BUILTIN_HASH_SIZE %u\n", seed, size);
+            return EXIT_SUCCESS;
+        }
+    }
+    fprintf(stderr, "mkbuiltins: no perfect hash for %d names\n", n);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,323 @@
+/*
+ * The work queue of the parallel builtin.
+ *
+ * The commands are built up front from the command template and the
+ * arguments, so starting the next one when a slot frees up only takes
+ * the next entry.  cush.c spawns and reaps them as processes of a
+ * single job.  The batch builtin uses the same queue, with commands
+ * that each take as many arguments as fit into one execve.
+ *
+ * Like the parser's argv, the commands are grown in an obstack, so
+ * building one costs no allocation per word and the whole queue is
+ * freed at once.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parallel.h"
+#include "utils.h"
+
+#define WORDS_CHUNK_SIZE (64 * 1024)
+
+/* Room kept free below ARG_MAX, as xargs does */
+#define BATCH_HEADROOM 2048
+
+extern char **environ;
+
+/* Return 'word' with every {} replaced by 'arg' */
+static char *
+substitute(struct obstack *words, const char *word, const char *arg)
+{
+    for (const char *p = word; *p != '\0'; ) {
+        if (p[0] == '{' && p[1] == '}') {
+            obstack_grow(words, arg, strlen(arg));
+            p += 2;
+        } else {
+            obstack_1grow(words, *p++);
+        }
+    }
+    obstack_1grow(words, '\0');
+    return obstack_finish(words);
+}
+
+/* Build the argv for 'arg' from the 'n' words of 'template' */
+static char **
+build_task(struct obstack *words, char **template, int n, const char *arg)
+{
+    bool placeholder = false;
+    for (int i = 0; i < n; i++)
+        placeholder |= strstr(template[i], "{}") != NULL;
+
+    char **argv = obstack_alloc(words, (n + 2) * sizeof *argv);
+    for (int i = 0; i < n; i++)
+        argv[i] = substitute(words, template[i], placeholder ? arg : "");
+    if (!placeholder)
+        argv[n++] = obstack_copy0(words, arg, strlen(arg));
+    argv[n] = NULL;
+    return argv;
+}
+
+static void
+add_task(struct parallel_queue *queue, int *allocated, char **argv)
+{
+    if (queue->ntasks == *allocated) {
+        *allocated = *allocated ? 2 * *allocated : 16;
+        queue->tasks = realloc(queue->tasks, *allocated * sizeof *queue->tasks);
+        if (queue->tasks == NULL)
+            utils_fatal_error("cannot allocate work queue: ");
+    }
+    queue->tasks[queue->ntasks++] = argv;
+}
+
+/* Allocate a queue whose commands go into its obstack */
+static struct parallel_queue *
+queue_create(int max_running)
+{
+    struct parallel_queue *queue = calloc(1, sizeof *queue);
+    if (queue == NULL)
+        utils_fatal_error("cannot allocate work queue: ");
+    queue->max_running = max_running;
+    obstack_specify_allocation(&queue->words, WORDS_CHUNK_SIZE, 0, malloc, free);
+    return queue;
+}
+
+/* Give the queue its stdio and no saved output, once all its
+ * commands are in */
+static struct parallel_queue *
+queue_finish(struct parallel_queue *queue)
+{
+    queue->output = malloc((queue->ntasks + 1) * sizeof *queue->output);
+    if (queue->output == NULL)
+        utils_fatal_error("cannot allocate work queue: ");
+    for (int t = 0; t < queue->ntasks; t++)
+        queue->output[t] = -1;
+    for (int fd = 0; fd < 3; fd++)
+        queue->stdio[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+    return queue;
+}
+
+/* The value of option argv[*i], as in -j4 or -j 4 */
+static const char *
+option_value(char **argv, int *i)
+{
+    return argv[*i][2] != '\0' ? argv[*i] + 2 : argv[++*i];
+}
+
+struct parallel_queue *
+parallel_queue_create(char **argv, FILE *input)
+{
+    int max_running = parallel_default_jobs();
+    bool group = false;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            group = true;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *n = option_value(argv, &i);
+            max_running = n != NULL ? atoi(n) : 0;
+            if (max_running <= 0)
+                goto usage;
+        } else {
+            goto usage;
+        }
+    }
+
+    char **template = argv + i;
+    int n = 0;
+    while (template[n] != NULL && strcmp(template[n], ":::") != 0)
+        n++;
+    if (n == 0)
+        goto usage;
+
+    struct parallel_queue *queue = queue_create(max_running);
+    queue->group = group;
+
+    int allocated = 0;
+    if (template[n] != NULL) {
+        for (char **arg = template + n + 1; *arg != NULL; arg++)
+            add_task(queue, &allocated, build_task(&queue->words, template, n, *arg));
+    } else {
+        char *line = NULL;
+        size_t size = 0;
+        ssize_t len;
+        while ((len = getline(&line, &size, input)) != -1) {
+            if (len > 0 && line[len - 1] == '\n')
+                line[len - 1] = '\0';
+            add_task(queue, &allocated, build_task(&queue->words, template, n, line));
+        }
+        free(line);
+    }
+    return queue_finish(queue);
+
+usage:
+    fprintf(stderr, "usage: parallel [-j jobs] [-g] command... [::: argument...]\n");
+    return NULL;
+}
+
+/* The bytes execve needs for 'word' in the new process's arguments */
+static size_t
+arg_size(const char *word)
+{
+    return strlen(word) + 1 + sizeof(char *);
+}
+
+/* The bytes that one command's arguments may take up: ARG_MAX less
+ * the environment the commands are spawned with */
+static size_t
+batch_room(void)
+{
+    long arg_max = sysconf(_SC_ARG_MAX);
+    size_t room = arg_max > 0 ? arg_max : _POSIX_ARG_MAX;
+    size_t used = BATCH_HEADROOM + 2 * sizeof(char *);
+    for (char **e = environ; *e != NULL; e++)
+        used += arg_size(*e);
+    return room > used ? room - used : 0;
+}
+
+/* Fill the queue with commands made of the 'n' words of 'template'
+ * followed by as many of the 'nwords' words as fit into 'room' bytes,
+ * and at most 'max_words' of them if that is not 0.  A word too long
+ * to fit next to the template still gets a command of its own, which
+ * then fails to spawn. */
+static void
+pack_batches(struct parallel_queue *queue, char **template, int n,
+             char **words, size_t nwords, size_t room, size_t max_words)
+{
+    size_t template_size = 0;
+    for (int i = 0; i < n; i++)
+        template_size += arg_size(template[i]);
+
+    int allocated = 0;
+    for (size_t w = 0; w < nwords; ) {
+        size_t size = template_size, count = 0;
+        obstack_grow(&queue->words, template, n * sizeof *template);
+        do {
+            size += arg_size(words[w]);
+            obstack_ptr_grow(&queue->words, words[w]);
+            w++, count++;
+        } while (w < nwords && size + arg_size(words[w]) <= room &&
+                 (max_words == 0 || count < max_words));
+        obstack_ptr_grow(&queue->words, NULL);
+        add_task(queue, &allocated, obstack_finish(&queue->words));
+    }
+}
+
+struct parallel_queue *
+parallel_queue_create_batch(char **argv, FILE *input)
+{
+    int max_running = 1;
+    size_t room = batch_room(), max_words = 0;
+    int i = 1;
+
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        char opt = argv[i][1];
+        if (opt == '\0' || strchr("jns", opt) == NULL)
+            goto usage;
+        const char *value = option_value(argv, &i);
+        long v = value != NULL ? atol(value) : 0;
+        if (v <= 0)
+            goto usage;
+        if (opt == 'j')
+            max_running = v;
+        else if (opt == 'n')
+            max_words = v;
+        else if ((size_t) v < room)
+            room = v;
+    }
+
+    char **template = argv + i;
+    int n = 0;
+    while (template[n] != NULL && strcmp(template[n], ":::") != 0)
+        n++;
+    if (n == 0)
+        goto usage;
+
+    struct parallel_queue *queue = queue_create(max_running);
+    if (template[n] != NULL) {
+        /* The words are used where they are */
+        char **words = template + n + 1;
+        size_t nwords = 0;
+        while (words[nwords] != NULL)
+            nwords++;
+        pack_batches(queue, template, n, words, nwords, room, max_words);
+        return queue_finish(queue);
+    }
+
+    /* Words read from 'input' are kept in the obstack, and their
+     * pointers in an array of their own until they are packed */
+    char **words = NULL, *line = NULL;
+    size_t nwords = 0, allocated = 0, size = 0;
+    while (getline(&line, &size, input) != -1) {
+        char *save;
+        for (char *w = strtok_r(line, " \t\n", &save); w != NULL;
+             w = strtok_r(NULL, " \t\n", &save)) {
+            if (nwords == allocated) {
+                allocated = allocated ? 2 * allocated : 1024;
+                words = realloc(words, allocated * sizeof *words);
+                if (words == NULL)
+                    utils_fatal_error("cannot allocate work queue: ");
+            }
+            words[nwords++] = obstack_copy0(&queue->words, w, strlen(w));
+        }
+    }
+    free(line);
+    pack_batches(queue, template, n, words, nwords, room, max_words);
+    free(words);
+    return queue_finish(queue);
+
+usage:
+    fprintf(stderr, "usage: batch [-j jobs] [-n words] [-s bytes] command... [::: word...]\n");
+    return NULL;
+}
+char **
+parallel_queue_next(struct parallel_queue *queue)
+{
+    if (parallel_queue_done(queue))
+        return NULL;
+    return queue->tasks[queue->next++];
+}
+
+bool
+parallel_queue_done(struct parallel_queue *queue)
+{
+    return queue->cancelled || queue->next == queue->ntasks;
+}
+
+void
+parallel_queue_free(struct parallel_queue *queue)
+{
+    for (int t = 0; t < queue->ntasks; t++) {
+        if (queue->output[t] != -1)
+            close(queue->output[t]);
+    }
+    for (int fd = 0; fd < 3; fd++)
+        if (queue->stdio[fd] != -1)
+            close(queue->stdio[fd]);
+    obstack_free(&queue->words, NULL);
+    free(queue->tasks);
+    free(queue->output);
+    free(queue);
+}
+
+int
+parallel_default_jobs(void)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof set, &set) == -1)
+        return sysconf(_SC_NPROCESSORS_ONLN);
+    return CPU_COUNT(&set);
+}
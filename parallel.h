@@ -0,0 +1,55 @@
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <obstack.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* The work queue of a "parallel" or "batch" job: the commands to run,
+ * of which at most 'max_running' run at the same time. */
+struct parallel_queue {
+    char ***tasks;              /* The argv of each command */
+    int ntasks;
+    int next;                   /* The next command to start */
+    int max_running;            /* -j, by default the usable CPUs */
+    bool group;                 /* -g: each command's output in one piece */
+    bool cancelled;             /* Start no more commands */
+    int failed;                 /* Commands that did not exit with 0 */
+    int stdio[3];               /* What the commands get as stdin, stdout
+                                   and stderr */
+    int *output;                /* With -g, where the output of each
+                                   process of the job is kept until it
+                                   is done, by slot; otherwise -1 */
+    struct obstack words;       /* Where the commands' argv live */
+};
+
+/* Build the queue for "parallel [-j N] [-g] command... [::: arg...]".
+ * Each argument replaces every {} in the command, or is appended to
+ * it if there is none.  Without ::: the arguments are the lines of
+ * 'input'.  The commands get the shell's current stdin, stdout and
+ * stderr.  Returns NULL after printing why on a usage error. */
+struct parallel_queue * parallel_queue_create(char **argv, FILE *input);
+
+/* Build the queue for "batch [-j N] [-n max] [-s bytes] command...
+ * [::: word...]": the command with as many of the words appended as
+ * ARG_MAX leaves room for next to the environment, or as -n and -s
+ * allow, and with the remaining words the next command, and so on.
+ * Without ::: the words are read from 'input', separated by blanks
+ * and newlines.  The command and the words after ::: are not copied
+ * and must outlive the queue.  By default the commands run one at a
+ * time. */
+struct parallel_queue * parallel_queue_create_batch(char **argv, FILE *input);
+
+/* The next command to start, or NULL if there is none */
+char ** parallel_queue_next(struct parallel_queue *queue);
+
+/* True once every command has been started, or none will be */
+bool parallel_queue_done(struct parallel_queue *queue);
+
+/* Free the queue and close its file descriptors */
+void parallel_queue_free(struct parallel_queue *queue);
+
+/* The number of CPUs this process may run on */
+int parallel_default_jobs(void);
+
+#endif /* __PARALLEL_H */
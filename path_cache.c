@@ -0,0 +1,268 @@
+/*
+ * A cache from command name to the file it resolves to in PATH.
+ *
+ * posix_spawnp searches PATH in the child by trying execve in each
+ * directory in turn, so a command in the fourth directory costs
+ * three failed execve calls on every spawn.  This cache remembers
+ * where a command was found, so the shell can spawn it with a single
+ * execve.
+ *
+ * An entry found in the k-th PATH directory is only valid as long as
+ * directories 0..k are unchanged: a new file in an earlier directory
+ * would shadow it, and removing it changes its own directory.  We
+ * record the mtime of each directory and check those of directories
+ * 0..k on every hit.  If any changed, or PATH itself changed, the
+ * whole cache is dropped.  Commands found in relative directories,
+ * such as ".", depend on the current directory and are not cached.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "path_cache.h"
+#include "utils.h"
+
+#define PATH_CACHE_MIN_CAPACITY 64
+
+/* PATH used by posix_spawnp when PATH is not set */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/* A directory in PATH and its state when we last looked at it */
+struct path_dir {
+    char *name;
+    bool exists;
+    struct timespec mtime;
+};
+
+struct path_entry {
+    char *name;             /* NULL if this bucket is empty */
+    char *path;
+    int dir;                /* The PATH directory the command is in */
+    unsigned hits;
+};
+
+static char *path_var;          /* The PATH the cache is for */
+static struct path_dir *dirs;
+static int ndirs;
+
+static struct path_entry *table;
+static size_t capacity;         /* Always a power of two */
+static size_t used;
+
+/* Result of the last lookup that was not cached */
+static char *uncached_path;
+
+/* FNV-1a */
+static size_t
+hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+    while (*name)
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    return h;
+}
+
+static struct path_entry *
+find(const char *name)
+{
+    if (used == 0)
+        return NULL;
+
+    size_t i = hash_name(name) & (capacity - 1);
+    while (table[i].name != NULL) {
+        if (strcmp(table[i].name, name) == 0)
+            return &table[i];
+        i = (i + 1) & (capacity - 1);
+    }
+    return NULL;
+}
+
+static void
+place(struct path_entry *t, size_t cap, struct path_entry *ent)
+{
+    size_t i = hash_name(ent->name) & (cap - 1);
+    while (t[i].name != NULL)
+        i = (i + 1) & (cap - 1);
+    t[i] = *ent;
+}
+
+static void
+rehash(size_t newcap)
+{
+    struct path_entry *t = calloc(newcap, sizeof *t);
+    if (t == NULL)
+        utils_fatal_error("cannot grow path cache: ");
+
+    for (size_t i = 0; i < capacity; i++)
+        if (table[i].name != NULL)
+            place(t, newcap, &table[i]);
+
+    free(table);
+    table = t;
+    capacity = newcap;
+}
+
+static void
+insert(char *name, char *path, int dir)
+{
+    /* Keep the load factor at or below 1/2 */
+    if (2 * (used + 1) > capacity)
+        rehash(capacity ? 2 * capacity : PATH_CACHE_MIN_CAPACITY);
+
+    place(table, capacity, &(struct path_entry) {
+        .name = name, .path = path, .dir = dir
+    });
+    used++;
+}
+
+void
+path_cache_clear(void)
+{
+    for (size_t i = 0; i < capacity; i++) {
+        free(table[i].name);
+        free(table[i].path);
+        table[i] = (struct path_entry) { .name = NULL };
+    }
+    used = 0;
+}
+
+/* Check directory d against what we last saw, and remember its
+ * current state.  Returns true if it did not change. */
+static bool
+dir_unchanged(struct path_dir *d)
+{
+    struct stat st;
+    bool exists = stat(*d->name ? d->name : ".", &st) == 0;
+    if (exists == d->exists && (!exists
+            || (st.st_mtim.tv_sec == d->mtime.tv_sec
+                && st.st_mtim.tv_nsec == d->mtime.tv_nsec)))
+        return true;
+
+    d->exists = exists;
+    if (exists)
+        d->mtime = st.st_mtim;
+    return false;
+}
+
+/* Drop everything if PATH is not what the cache was built for */
+static void
+sync_path(void)
+{
+    const char *p = getenv("PATH");
+    if (p == NULL)
+        p = DEFAULT_PATH;
+    if (path_var != NULL && strcmp(path_var, p) == 0)
+        return;
+
+    path_cache_clear();
+    for (int i = 0; i < ndirs; i++)
+        free(dirs[i].name);
+    free(dirs);
+    free(path_var);
+
+    path_var = strdup(p);
+    ndirs = 1;
+    for (const char *c = p; *c; c++)
+        ndirs += *c == ':';
+    dirs = calloc(ndirs, sizeof *dirs);
+    if (path_var == NULL || dirs == NULL)
+        utils_fatal_error("cannot allocate path cache: ");
+
+    for (int i = 0; i < ndirs; i++) {
+        size_t len = strcspn(p, ":");
+        dirs[i].name = strndup(p, len);
+        if (dirs[i].name == NULL)
+            utils_fatal_error("cannot allocate path cache: ");
+        dir_unchanged(&dirs[i]);
+        p += len + (p[len] == ':');
+    }
+}
+
+/* Search PATH for 'name' */
+static const char *
+resolve(const char *name)
+{
+    size_t namelen = strlen(name);
+    for (int i = 0; i < ndirs; i++) {
+        /* Entries already in the cache may depend on this directory */
+        if (!dir_unchanged(&dirs[i]))
+            path_cache_clear();
+        if (!dirs[i].exists)
+            continue;
+
+        const char *dir = *dirs[i].name ? dirs[i].name : ".";
+        size_t dirlen = strlen(dir);
+        char *path = malloc(dirlen + namelen + 2);
+        if (path == NULL)
+            utils_fatal_error("cannot allocate path cache: ");
+        memcpy(path, dir, dirlen);
+        path[dirlen] = '/';
+        memcpy(path + dirlen + 1, name, namelen + 1);
+
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode)
+            && access(path, X_OK) == 0) {
+            if (dir[0] != '/') {
+                free(uncached_path);
+                return uncached_path = path;
+            }
+            char *key = strdup(name);
+            if (key == NULL)
+                utils_fatal_error("cannot allocate path cache: ");
+            insert(key, path, i);
+            return path;
+        }
+        free(path);
+    }
+    return NULL;
+}
+
+/* Return the entry for 'name' if it is still valid */
+static struct path_entry *
+valid_entry(const char *name)
+{
+    sync_path();
+    struct path_entry *ent = find(name);
+    if (ent == NULL)
+        return NULL;
+
+    for (int i = 0; i <= ent->dir; i++) {
+        if (!dir_unchanged(&dirs[i])) {
+            path_cache_clear();
+            return NULL;
+        }
+    }
+    return ent;
+}
+
+const char *
+path_cache_peek(const char *name)
+{
+    struct path_entry *ent = valid_entry(name);
+    return ent ? ent->path : NULL;
+}
+
+const char *
+path_cache_lookup(const char *name)
+{
+    struct path_entry *ent = valid_entry(name);
+    if (ent == NULL) {
+        const char *path = resolve(name);
+        if (path == NULL || (ent = find(name)) == NULL)
+            return path;
+    }
+    ent->hits++;
+    return ent->path;
+}
+
+void
+path_cache_foreach(void (*fn)(const char *name, const char *path,
+                              unsigned hits, void *arg), void *arg)
+{
+    for (size_t i = 0; i < capacity; i++)
+        if (table[i].name != NULL)
+            fn(table[i].name, table[i].path, table[i].hits, arg);
+}
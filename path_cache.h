@@ -0,0 +1,27 @@
+#ifndef __PATH_CACHE_H
+#define __PATH_CACHE_H
+
+#include <stdbool.h>
+
+/* A cache from command name to the file PATH resolves it to.
+ * Entries are dropped when PATH changes or when one of the PATH
+ * directories searched to find them has been modified. */
+
+/* Return the path of command 'name', searching PATH and remembering
+ * the result on a miss.  Returns NULL if PATH has no such command.
+ * 'name' must not contain a '/'.  The result stays valid until the
+ * next call into the cache. */
+const char * path_cache_lookup(const char *name);
+
+/* Like path_cache_lookup, but do not search PATH on a miss */
+const char * path_cache_peek(const char *name);
+
+/* Forget all commands */
+void path_cache_clear(void);
+
+/* Call 'fn' for each remembered command.  'hits' counts how often
+ * path_cache_lookup returned the entry. */
+void path_cache_foreach(void (*fn)(const char *name, const char *path,
+                                   unsigned hits, void *arg), void *arg);
+
+#endif /* __PATH_CACHE_H */
@@ -0,0 +1,120 @@
+/*
+ * A hash index from child pid to the job that owns it.
+ *
+ * Reaping a child must not cost more as the job table grows, so
+ * instead of walking every job's pid list we keep an open-addressing
+ * table with linear probing.  Deletion shifts later entries of the
+ * same probe run backwards, so there are no tombstones and lookups
+ * stay short no matter how many jobs have come and gone.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "pid_index.h"
+#include "utils.h"
+
+#define PID_INDEX_MIN_CAPACITY 64
+
+static struct pid_index_entry *table;
+static size_t capacity;         /* Always a power of two */
+static size_t used;
+
+/* Fibonacci hashing spreads consecutive pids across the table */
+static inline size_t
+bucket_of(pid_t pid)
+{
+    return ((uint32_t) pid * 2654435761u) & (capacity - 1);
+}
+
+static void
+place(struct pid_index_entry *t, size_t cap, struct pid_index_entry *ent)
+{
+    size_t i = ((uint32_t) ent->pid * 2654435761u) & (cap - 1);
+    while (t[i].pid != 0)
+        i = (i + 1) & (cap - 1);
+    t[i] = *ent;
+}
+
+/* Resize the table to 'newcap' buckets and rehash all entries */
+static void
+rehash(size_t newcap)
+{
+    struct pid_index_entry *t = calloc(newcap, sizeof *t);
+    if (t == NULL)
+        utils_fatal_error("cannot grow pid index: ");
+
+    for (size_t i = 0; i < capacity; i++)
+        if (table[i].pid != 0)
+            place(t, newcap, &table[i]);
+
+    free(table);
+    table = t;
+    capacity = newcap;
+}
+
+void
+pid_index_insert(pid_t pid, void *owner, int slot)
+{
+    assert(pid > 0);
+    /* Keep the load factor at or below 1/2 */
+    if (2 * (used + 1) > capacity)
+        rehash(capacity ? 2 * capacity : PID_INDEX_MIN_CAPACITY);
+
+    size_t i = bucket_of(pid);
+    while (table[i].pid != 0 && table[i].pid != pid)
+        i = (i + 1) & (capacity - 1);
+
+    if (table[i].pid == 0)
+        used++;
+    table[i] = (struct pid_index_entry) {
+        .pid = pid, .owner = owner, .slot = slot
+    };
+}
+
+struct pid_index_entry *
+pid_index_lookup(pid_t pid)
+{
+    if (used == 0)
+        return NULL;
+
+    for (size_t i = bucket_of(pid); table[i].pid != 0; i = (i + 1) & (capacity - 1))
+        if (table[i].pid == pid)
+            return &table[i];
+
+    return NULL;
+}
+
+void
+pid_index_remove(pid_t pid)
+{
+    struct pid_index_entry *ent = pid_index_lookup(pid);
+    if (ent == NULL)
+        return;
+
+    /* Backward-shift deletion: move up any entry in the rest of
+     * this probe run whose home bucket lies at or before the hole. */
+    size_t hole = ent - table;
+    size_t j = hole;
+    for (;;) {
+        j = (j + 1) & (capacity - 1);
+        if (table[j].pid == 0)
+            break;
+
+        size_t home = bucket_of(table[j].pid);
+        if (((j - home) & (capacity - 1)) >= ((j - hole) & (capacity - 1))) {
+            table[hole] = table[j];
+            hole = j;
+        }
+    }
+    memset(&table[hole], 0, sizeof table[hole]);
+    used--;
+}
+
+size_t
+pid_index_size(void)
+{
+    return used;
+}
@@ -0,0 +1,28 @@
+#ifndef __PID_INDEX_H
+#define __PID_INDEX_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Where a child process lives: the job that owns it and the
+ * slot it occupies in that job's list of pids. */
+struct pid_index_entry {
+    pid_t pid;               /* 0 if this bucket is empty */
+    void *owner;             /* The job this process belongs to */
+    int slot;                /* Index into the owner's pid list */
+};
+
+/* Record that 'pid' belongs to 'owner' at position 'slot'. */
+void pid_index_insert(pid_t pid, void *owner, int slot);
+
+/* Return the entry for 'pid', or NULL if it is not known. */
+struct pid_index_entry * pid_index_lookup(pid_t pid);
+
+/* Forget 'pid'.  Does nothing if it is not known. */
+void pid_index_remove(pid_t pid);
+
+/* Number of pids currently in the index */
+size_t pid_index_size(void);
+
+#endif /* __PID_INDEX_H */
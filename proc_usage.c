@@ -0,0 +1,82 @@
+/*
+ * Resource usage of child processes.
+ *
+ * wait4 reports a child's usage once, when it is reaped.  Jobs that
+ * are still running, which is what "jobs -l" mostly shows, have not
+ * been reaped yet, so their usage so far is read from /proc: CPU times
+ * from /proc/pid/stat and the peak RSS and context switches from
+ * /proc/pid/status.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "proc_usage.h"
+
+/* Read /proc/pid/'file' into buf.  Returns the length, or -1. */
+static ssize_t
+read_proc_file(pid_t pid, const char *file, char *buf, size_t size)
+{
+    char path[64];
+    snprintf(path, sizeof path, "/proc/%d/%s", (int) pid, file);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+
+    size_t len = fread(buf, 1, size - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+    return len;
+}
+
+bool
+proc_usage_read(pid_t pid, struct proc_usage *usage)
+{
+    char buf[4096];
+    unsigned long utime, stime;
+
+    /* The command name in parentheses may contain anything, so start
+     * after the last ')'.  utime and stime are fields 14 and 15. */
+    if (read_proc_file(pid, "stat", buf, sizeof buf) == -1)
+        return false;
+    char *p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                            &utime, &stime) != 2)
+        return false;
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    *usage = (struct proc_usage) {
+        .utime = (double) utime / ticks,
+        .stime = (double) stime / ticks,
+    };
+
+    if (read_proc_file(pid, "status", buf, sizeof buf) == -1)
+        return false;
+    for (char *line = buf; line != NULL; line = strchr(line, '\n')) {
+        line += *line == '\n';
+        sscanf(line, "VmHWM: %ld", &usage->maxrss);
+        sscanf(line, "voluntary_ctxt_switches: %ld", &usage->nvcsw);
+        sscanf(line, "nonvoluntary_ctxt_switches: %ld", &usage->nivcsw);
+    }
+    return true;
+}
+
+void
+proc_usage_add(struct proc_usage *total, const struct proc_usage *part)
+{
+    total->utime += part->utime;
+    total->stime += part->stime;
+    if (part->maxrss > total->maxrss)
+        total->maxrss = part->maxrss;
+    total->nvcsw += part->nvcsw;
+    total->nivcsw += part->nivcsw;
+}
+
+void
+proc_usage_print(FILE *out, const struct proc_usage *usage)
+{
+    fprintf(out, "user %.3fs sys %.3fs maxrss %ldK ctxsw %ld/%ld",
+            usage->utime, usage->stime, usage->maxrss,
+            usage->nvcsw, usage->nivcsw);
+}
@@ -0,0 +1,29 @@
+#ifndef __PROC_USAGE_H
+#define __PROC_USAGE_H
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* The resources a process has used.  For a process that was reaped
+ * these are what wait4 reported; for one that is still running they
+ * are read from /proc. */
+struct proc_usage {
+    double utime;               /* CPU time in user mode, in seconds */
+    double stime;               /* CPU time in the kernel, in seconds */
+    long maxrss;                /* Peak resident set size in KiB */
+    long nvcsw;                 /* Voluntary context switches */
+    long nivcsw;                /* Involuntary context switches */
+};
+
+/* Read the usage of running process 'pid' from /proc.  Returns false
+ * if the process is gone. */
+bool proc_usage_read(pid_t pid, struct proc_usage *usage);
+
+/* Add 'part' to 'total'.  The peak RSS of the sum is the larger one. */
+void proc_usage_add(struct proc_usage *total, const struct proc_usage *part);
+
+/* Print "user U sys S maxrss MK ctxsw V/I" */
+void proc_usage_print(FILE *out, const struct proc_usage *usage);
+
+#endif /* __PROC_USAGE_H */
@@ -0,0 +1,244 @@
+/*
+ * Parallel parsing of scripts.
+ *
+ * The script is cut into blocks of BLOCK_SIZE bytes.  A line belongs
+ * to the block that holds its first byte.  Workers claim blocks in
+ * order and parse all lines of a block with their own parse context.
+ * The consumer reads blocks in order from a window of WINDOW slots;
+ * a worker waits before claiming a block that would not fit into
+ * the window.  If the consumer needs a block no worker has claimed
+ * yet, it parses that block itself, so a script that fits into one
+ * block is parsed without starting any threads.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script_parser.h"
+#include "shell-ast.h"
+#include "utils.h"
+
+#define BLOCK_SIZE  (16 * 1024)
+#define WINDOW      64
+
+struct block {
+    bool done;                  /* all lines have been parsed */
+    struct parsed_line *lines;
+    int nlines;
+};
+
+struct script_parser {
+    const char *text;
+    size_t len;
+    size_t nblocks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t parsed;      /* signaled when a block is done */
+    pthread_cond_t room;        /* signaled when the consumer moves on */
+    size_t next_block;          /* next block a worker will claim */
+    size_t current;             /* block the consumer is reading */
+    int next_line;              /* next line within the current block */
+    bool stopping;
+    struct block window[WINDOW];
+
+    int nthreads;
+    pthread_t *threads;
+
+    /* used when the consumer parses a block itself */
+    struct ast_parse_context *ctx;
+    char *buf;
+    size_t bufsize;
+};
+
+/* Parse the lines that start in block k */
+static void
+parse_block(struct script_parser *parser, struct ast_parse_context *ctx,
+            size_t k, struct block *block, char **buf, size_t *bufsize)
+{
+    const char *text = parser->text;
+    size_t pos = k * BLOCK_SIZE;
+    size_t end = pos + BLOCK_SIZE < parser->len ? pos + BLOCK_SIZE : parser->len;
+    int capacity = 0;
+
+    /* skip the tail of a line that started in an earlier block */
+    if (pos > 0 && text[pos - 1] != '\n') {
+        const char *nl = memchr(text + pos, '\n', parser->len - pos);
+        pos = nl ? nl - text + 1 : parser->len;
+    }
+
+    while (pos < end) {
+        const char *nl = memchr(text + pos, '\n', parser->len - pos);
+        size_t eol = nl ? nl - text : parser->len;
+        size_t n = eol - pos;
+
+        /* the scanner needs two trailing '\0' bytes */
+        if (n + 2 > *bufsize) {
+            *bufsize = n + 2 > 2 * *bufsize ? n + 2 : 2 * *bufsize;
+            *buf = realloc(*buf, *bufsize);
+            if (*buf == NULL)
+                utils_fatal_error("realloc failed: ");
+        }
+        memcpy(*buf, text + pos, n);
+        (*buf)[n] = (*buf)[n + 1] = '\0';
+
+        if (block->nlines == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            block->lines = realloc(block->lines, capacity * sizeof *block->lines);
+            if (block->lines == NULL)
+                utils_fatal_error("realloc failed: ");
+        }
+        struct parsed_line *line = &block->lines[block->nlines++];
+        line->cline = ast_parse_command_buffer_r(ctx, *buf, n);
+        line->error = ast_parse_context_error(ctx);
+
+        pos = eol + 1;
+    }
+}
+
+static void *
+worker(void *arg)
+{
+    struct script_parser *parser = arg;
+    struct ast_parse_context *ctx = ast_parse_context_create();
+    if (ctx == NULL)
+        utils_fatal_error("cannot create parse context: ");
+
+    size_t bufsize = 256;
+    char *buf = malloc(bufsize);
+
+    pthread_mutex_lock(&parser->lock);
+    for (;;) {
+        while (!parser->stopping && parser->next_block < parser->nblocks
+               && parser->next_block >= parser->current + WINDOW)
+            pthread_cond_wait(&parser->room, &parser->lock);
+
+        if (parser->stopping || parser->next_block >= parser->nblocks)
+            break;
+
+        size_t k = parser->next_block++;
+        pthread_mutex_unlock(&parser->lock);
+
+        struct block block = { .done = true };
+        parse_block(parser, ctx, k, &block, &buf, &bufsize);
+
+        pthread_mutex_lock(&parser->lock);
+        parser->window[k % WINDOW] = block;
+        pthread_cond_broadcast(&parser->parsed);
+    }
+    pthread_mutex_unlock(&parser->lock);
+
+    free(buf);
+    ast_parse_context_destroy(ctx);
+    return NULL;
+}
+
+struct script_parser *
+script_parser_create(const char *text, size_t len, int nthreads)
+{
+    struct script_parser *parser = calloc(1, sizeof *parser);
+    if (parser == NULL)
+        return NULL;
+
+    parser->text = text;
+    parser->len = len;
+    parser->nblocks = (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    pthread_mutex_init(&parser->lock, NULL);
+    pthread_cond_init(&parser->parsed, NULL);
+    pthread_cond_init(&parser->room, NULL);
+
+    /* the consumer takes care of at least one block */
+    if (nthreads > (int) parser->nblocks - 1)
+        nthreads = parser->nblocks - 1;
+    if (nthreads < 0)
+        nthreads = 0;
+    parser->threads = calloc(nthreads ? nthreads : 1, sizeof *parser->threads);
+
+    /* Workers must not take any of the shell's signals. */
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&parser->threads[i], NULL, worker, parser))
+            break;
+        parser->nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    return parser;
+}
+
+bool
+script_parser_next(struct script_parser *parser, struct parsed_line *line)
+{
+    bool found = false;
+    pthread_mutex_lock(&parser->lock);
+    while (parser->current < parser->nblocks) {
+        struct block *block = &parser->window[parser->current % WINDOW];
+        while (!block->done) {
+            if (parser->next_block > parser->current) {
+                pthread_cond_wait(&parser->parsed, &parser->lock);
+                continue;
+            }
+
+            /* no worker got to this block yet; parse it here */
+            parser->next_block++;
+            pthread_mutex_unlock(&parser->lock);
+
+            if (parser->ctx == NULL
+                && (parser->ctx = ast_parse_context_create()) == NULL)
+                utils_fatal_error("cannot create parse context: ");
+
+            struct block parsed = { .done = true };
+            parse_block(parser, parser->ctx, parser->current, &parsed,
+                        &parser->buf, &parser->bufsize);
+
+            pthread_mutex_lock(&parser->lock);
+            *block = parsed;
+        }
+
+        if (parser->next_line < block->nlines) {
+            *line = block->lines[parser->next_line++];
+            found = true;
+            break;
+        }
+
+        /* done with this block, make room for the workers */
+        free(block->lines);
+        *block = (struct block) { .done = false };
+        parser->current++;
+        parser->next_line = 0;
+        pthread_cond_broadcast(&parser->room);
+    }
+    pthread_mutex_unlock(&parser->lock);
+    return found;
+}
+
+void
+script_parser_destroy(struct script_parser *parser)
+{
+    pthread_mutex_lock(&parser->lock);
+    parser->stopping = true;
+    pthread_cond_broadcast(&parser->room);
+    pthread_mutex_unlock(&parser->lock);
+
+    for (int i = 0; i < parser->nthreads; i++)
+        pthread_join(parser->threads[i], NULL);
+
+    for (int i = 0; i < WINDOW; i++) {
+        struct block *block = &parser->window[i];
+        bool is_current = i == parser->current % WINDOW;
+        for (int j = is_current ? parser->next_line : 0; j < block->nlines; j++)
+            if (block->lines[j].cline != NULL)
+                ast_command_line_free(block->lines[j].cline);
+        free(block->lines);
+    }
+
+    if (parser->ctx != NULL)
+        ast_parse_context_destroy(parser->ctx);
+    free(parser->buf);
+    pthread_cond_destroy(&parser->room);
+    pthread_cond_destroy(&parser->parsed);
+    pthread_mutex_destroy(&parser->lock);
+    free(parser->threads);
+    free(parser);
+}
@@ -0,0 +1,36 @@
+#ifndef __SCRIPT_PARSER_H
+#define __SCRIPT_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Parse the lines of a script on worker threads while the shell
+ * executes the lines parsed so far.  Lines are handed out in the
+ * order in which they appear in the script.  Workers stay a bounded
+ * number of blocks ahead of the consumer, so the memory used for
+ * parsed lines does not grow with the size of the script.
+ */
+struct script_parser;
+
+/* One parsed line of the script */
+struct parsed_line {
+    struct ast_command_line *cline;     /* NULL if the line had an error */
+    const char *error;                  /* csh-style message, or NULL */
+};
+
+/* Start parsing text[0..len) with up to nthreads workers; short
+ * scripts get fewer.  The text must stay valid, and unchanged, until
+ * the parser is destroyed. */
+struct script_parser * script_parser_create(const char *text, size_t len,
+                                            int nthreads);
+
+/* Get the next line of the script.  Blocks until it has been parsed.
+ * Returns false at the end of the script.  The caller owns
+ * line->cline and must free it with ast_command_line_free(). */
+bool script_parser_next(struct script_parser *parser, struct parsed_line *line);
+
+/* Stop the workers and free all lines not yet handed out */
+void script_parser_destroy(struct script_parser *parser);
+
+#endif /* __SCRIPT_PARSER_H */
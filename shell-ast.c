@@ -13,25 +13,28 @@
 
 #include "shell-ast.h"
 
-/* Create new command structure.  Takes ownership of argv. */
+/* Create new command structure.  argv must live in the same arena. */
 struct ast_command * 
-ast_command_create(char ** argv, bool dup_stderr_to_stdout)
+ast_command_create(struct arena *arena, char ** argv, bool dup_stderr_to_stdout)
 {
-    struct ast_command *cmd = malloc(sizeof *cmd);
+    struct ast_command *cmd = arena_alloc(arena, sizeof *cmd);
 
     cmd->argv = argv;
     cmd->dup_stderr_to_stdout = dup_stderr_to_stdout;
+    cmd->patterns = NULL;
     return cmd;
 }
 
 /* Create a new pipeline */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+struct ast_pipeline * ast_pipeline_create(struct arena *arena,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output)
 {
-    struct ast_pipeline *pipe = malloc(sizeof *pipe);
+    struct ast_pipeline *pipe = arena_alloc(arena, sizeof *pipe);
 
     list_init(&pipe->commands);
+    pipe->arena = arena_retain(arena);
     pipe->iored_output = iored_output;
     pipe->iored_input = iored_input;
     pipe->append_to_output = append_to_output;
@@ -48,19 +51,20 @@ ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd)
 
 /* Create an empty command line */
 struct ast_command_line *
-ast_command_line_create_empty(void)
+ast_command_line_create_empty(struct arena *arena)
 {
-    struct ast_command_line *cmdline = malloc(sizeof *cmdline);
+    struct ast_command_line *cmdline = arena_alloc(arena, sizeof *cmdline);
 
     list_init(&cmdline->pipes);
+    cmdline->arena = arena;
     return cmdline;
 }
 
 /* Create a command line with a single pipeline */
 struct ast_command_line *
-ast_command_line_create(struct ast_pipeline *pipe)
+ast_command_line_create(struct arena *arena, struct ast_pipeline *pipe)
 {
-    struct ast_command_line *cmdline = ast_command_line_create_empty();
+    struct ast_command_line *cmdline = ast_command_line_create_empty(arena);
 
     list_push_back(&cmdline->pipes, &pipe->elem);
     return cmdline;
@@ -128,7 +132,9 @@ ast_command_line_print(struct ast_command_line *cmdline)
     printf("==========================================\n");
 }
 
-/* Deallocation functions. */
+/* Deallocation functions.
+ * The memory itself belongs to the arena; freeing a pipeline or a
+ * command line drops its reference to the arena. */
 void 
 ast_command_line_free(struct ast_command_line *cmdline)
 {
@@ -137,33 +143,11 @@ ast_command_line_free(struct ast_command_line *cmdline)
         e = list_remove(e);
         ast_pipeline_free(pipe);
     }
-    free(cmdline);
+    arena_release(cmdline->arena);
 }
 
 void 
 ast_pipeline_free(struct ast_pipeline *pipe)
 {
-    for (struct list_elem * e = list_begin(&pipe->commands); e != list_end(&pipe->commands); ) {
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        e = list_remove(e);
-        ast_command_free(cmd);
-    }
-    if (pipe->iored_input)
-        free(pipe->iored_input);
-
-    if (pipe->iored_output)
-        free(pipe->iored_output);
-
-    free(pipe);
-}
-
-void 
-ast_command_free(struct ast_command * cmd)
-{
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
-    }
-    free(cmd->argv);
-    free(cmd);
+    arena_release(pipe->arena);
 }
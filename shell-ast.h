@@ -2,15 +2,19 @@
 #define __SHELL_AST_H
 
 #include "list.h"
+#include "arena.h"
 
 /* Forward declarations. */
 struct ast_command;
 struct ast_pipeline;
 struct ast_command_line;
 
-/* A command line may contain multiple pipelines. */
+/* A command line may contain multiple pipelines.
+ * All memory of a command line, including its pipelines, commands,
+ * and words, is allocated from a single arena. */
 struct ast_command_line {
     struct list/* <ast_pipeline> */ pipes;        /* List of pipelines */
+    struct arena *arena;     /* Arena everything is allocated from */
 };
 
 /* A pipeline is a list of one or more commands. 
@@ -24,6 +28,9 @@ struct ast_pipeline {
                                 file 'iored_output' */
     bool append_to_output;   /* True if user typed >> to append */
     bool bg_job;             /* True if user entered & */
+    struct arena *arena;     /* Arena of the command line this pipeline
+                                came from; the pipeline holds a reference
+                                so it may outlive the command line. */
     struct list_elem elem;   /* Link element. */
 };
 
@@ -32,31 +39,38 @@ struct ast_command {
     char **argv;             /* NULL terminated array of pointers to words
                                 making up this command. */
     bool dup_stderr_to_stdout; /* True if stderr should be redirected as well */
+    char **patterns;         /* NULL terminated array of the words in argv,
+                                in order, that are subject to pathname
+                                expansion; NULL if there are none. */
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 };
 
 /* Create new command structure and initialize it */
-struct ast_command * ast_command_create(char ** argv,
+struct ast_command * ast_command_create(struct arena *arena,
+                                        char ** argv,
                                         bool dup_stderr_to_stdout);
 
 /* Create a new pipeline containing only one command */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+struct ast_pipeline * ast_pipeline_create(struct arena *arena,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output);
 
 /* Add a new command to this pipeline */
 void ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd);
 
-/* Create an empty command line */
-struct ast_command_line * ast_command_line_create_empty(void);
+/* Create an empty command line.  Takes over the caller's reference
+ * to the arena. */
+struct ast_command_line * ast_command_line_create_empty(struct arena *arena);
 
 /* Create a command line with a single pipeline */
-struct ast_command_line * ast_command_line_create(struct ast_pipeline *pipe);
+struct ast_command_line * ast_command_line_create(struct arena *arena,
+                                                  struct ast_pipeline *pipe);
 
-/* Deallocation functions */
+/* Deallocation functions.  Commands are freed with their pipeline.
+ * Pipelines still in the command line are freed with it. */
 void ast_command_line_free(struct ast_command_line *);
 void ast_pipeline_free(struct ast_pipeline *);
-void ast_command_free(struct ast_command *);
 
 /* Print functions */
 void ast_command_print(struct ast_command *cmd);
@@ -66,5 +80,19 @@ void ast_command_line_print(struct ast_command_line *line);
 /* Parse a command line.  Implemented in shell-grammar.y */
 struct ast_command_line * ast_parse_command_line(char * line);
 
+/* Parse a command line in place, without copying it.
+ * buf must have two '\0' bytes at buf[len] and buf[len + 1]. */
+struct ast_command_line * ast_parse_command_buffer(char * buf, size_t len);
+
+/* Reentrant parsing.  Each thread parses with its own context.
+ * Instead of printing errors, ast_parse_command_buffer_r returns
+ * NULL and leaves the message in the context. */
+struct ast_parse_context;
+struct ast_parse_context * ast_parse_context_create(void);
+void ast_parse_context_destroy(struct ast_parse_context *ctx);
+struct ast_command_line * ast_parse_command_buffer_r(
+        struct ast_parse_context *ctx, char * buf, size_t len);
+const char * ast_parse_context_error(struct ast_parse_context *ctx);
+
 /** ----------------------------------------------------------- */
 #endif /* __SHELL_AST_H */
@@ -9,15 +9,15 @@
  * This is based on an assignment as an undergraduate in 1993 
  * as an undergraduate student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * Everything allocated while parsing a line comes from one arena,
+ * so a parse error frees it all with a single call.
  */
 %{
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #define YYDEBUG	1
 int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
 
 /*
  * Error messages, csh-style
@@ -31,11 +31,43 @@ int yylex(void);
 #include <obstack.h>
 #include <assert.h>
 
-#define obstack_chunk_alloc malloc
-#define obstack_chunk_free free
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+/*
+ * Everything one parse needs.  The scanner and the parser keep
+ * no global state, so each thread can parse with its own context.
+ */
+struct ast_parse_context {
+    yyscan_t scanner;
+    struct arena *arena;        /* arena for the line being parsed */
+    struct ast_command_line *commandline;   /* result */
+    const char *error;          /* csh-style message if parse failed */
+};
+
+/* obstack chunks for argv are carved out of the parse arena */
+static void *
+words_chunk_alloc(void *arena, size_t size)
+{
+    return arena_alloc(arena, size);
+}
+
+static void
+words_chunk_free(void *arena, void *chunk)
+{
+    /* released together with the arena */
+}
+
+#define WORDS_CHUNK_SIZE 256
+#define PATTERNS_CHUNK_SIZE 64
 
 struct cmd_helper {
     struct obstack words;   /* an obstack of char * to collect argv */
+    struct obstack patterns;    /* the words that are patterns, once
+                                   there is one */
+    bool has_patterns;
     char *iored_input;
     char *iored_output;
     bool append_to_output;
@@ -48,24 +80,27 @@ struct pipe_helper {
 };
 
 static struct pipe_helper *
-init_pipe()
+init_pipe(struct ast_parse_context *ctx)
 {
-    struct pipe_helper * pipe = calloc(1, sizeof *pipe);
+    struct pipe_helper * pipe = arena_calloc(ctx->arena, sizeof *pipe);
     list_init(&pipe->commands);
     return pipe;
 }
 
 /* Initialize cmd_helper and, optionally, set first argv */
 static struct cmd_helper *
-init_cmd(char *firstcmd, 
+init_cmd(struct ast_parse_context *ctx, char *firstcmd, 
          char *iored_input, char *iored_output, 
          bool append_to_output, bool include_stderr)
 {
-    struct cmd_helper * cmd = malloc(sizeof *cmd);
-    obstack_init(&cmd->words);
+    struct cmd_helper * cmd = arena_alloc(ctx->arena, sizeof *cmd);
+    obstack_specify_allocation_with_arg(&cmd->words, WORDS_CHUNK_SIZE, 0,
+                                        words_chunk_alloc, words_chunk_free,
+                                        ctx->arena);
     if (firstcmd)
         obstack_ptr_grow(&cmd->words, firstcmd);
 
+    cmd->has_patterns = false;
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
     cmd->append_to_output = append_to_output;
@@ -73,32 +108,48 @@ init_cmd(char *firstcmd,
     return cmd;
 }
 
-/* print error message */
-static void p_error(char *msg);
+/* Remember that 'word', just added to cmd, is subject to pathname
+ * expansion.  Most commands have no such word, so the obstack is only
+ * set up for the first one. */
+static void
+add_pattern(struct ast_parse_context *ctx, struct cmd_helper *cmd, char *word)
+{
+    if (!cmd->has_patterns) {
+        obstack_specify_allocation_with_arg(&cmd->patterns, PATTERNS_CHUNK_SIZE, 0,
+                                            words_chunk_alloc, words_chunk_free,
+                                            ctx->arena);
+        cmd->has_patterns = true;
+    }
+    obstack_ptr_grow(&cmd->patterns, word);
+}
+
+/* record error message */
+static void p_error(struct ast_parse_context *ctx, const char *msg);
 
 /* Convert cmd_helper to ast_command.
- * Ensures NULL-terminated argv[] array
+ * Ensures NULL-terminated argv[] array.  The array is used in place;
+ * it already lives in the parse arena.
  */
 static struct ast_command * 
-make_ast_command(struct cmd_helper *cmd)
+make_ast_command(struct ast_parse_context *ctx, struct cmd_helper *cmd)
 {
     obstack_ptr_grow(&cmd->words, NULL);
+    char **argv = obstack_finish(&cmd->words);
 
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
-
-    if (*argv == NULL) {
-        free(argv);
+    if (*argv == NULL)
         return NULL; 
-    }
 
-    return ast_command_create(argv, cmd->redirect_stderr);
+    struct ast_command *command;
+    command = ast_command_create(ctx->arena, argv, cmd->redirect_stderr);
+    if (cmd->has_patterns) {
+        obstack_ptr_grow(&cmd->patterns, NULL);
+        command->patterns = obstack_finish(&cmd->patterns);
+    }
+    return command;
 }
 
 static bool
-add_to_pipeline(struct pipe_helper *pipe,
+add_to_pipeline(struct ast_parse_context *ctx, struct pipe_helper *pipe,
                 struct cmd_helper *cmd,
                 bool redirect_stderr)
 {
@@ -107,27 +158,30 @@ add_to_pipeline(struct pipe_helper *pipe,
         last = list_entry(list_back(&pipe->commands), 
                           struct cmd_helper, elem);
         /* Error: 'ls >x | wc' */
-        if (last->iored_output) { p_error(AMBOUT); return false; }
+        if (last->iored_output) { p_error(ctx, AMBOUT); return false; }
         last->redirect_stderr = redirect_stderr;
 
         /* Error: 'ls | <x wc' */
-        if (cmd->iored_input) { p_error(AMBINP); return false; }
+        if (cmd->iored_input) { p_error(ctx, AMBINP); return false; }
     }
 
     int sz = obstack_object_size(&cmd->words);
-    if (sz == 0) { p_error(INVNUL); return false; }
+    if (sz == 0) { p_error(ctx, INVNUL); return false; }
 
     list_push_back(&pipe->commands, &cmd->elem);
     return true;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct ast_command_line *);
+%}
 
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
+%define api.pure full
+%param {yyscan_t scanner}
+%parse-param {struct ast_parse_context *ctx}
 
-%}
+%code {
+int yylex(YYSTYPE *yylval_param, yyscan_t scanner);
+void yyerror(yyscan_t scanner, struct ast_parse_context *ctx, const char *msg);
+}
 
 /* LALR stack types */
 %union {
@@ -144,17 +198,18 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
 %type <pipe> pipeline
 %type <ast_pipe> ast_pipeline
 %type <cmdline> cmd_list
+%type <word> word
 
 /* Terminals */
-%token <word> WORD
+%token <word> WORD PATTERN
 %token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND
 
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
+cmd_line: cmd_list { ctx->commandline = $1; }
 
-cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(); }
+cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(ctx->arena); }
 |		ast_pipeline { 
-            $$ = ast_command_line_create($1);
+            $$ = ast_command_line_create(ctx->arena, $1);
         } 
 |		cmd_list ';'
 |		cmd_list '&' {
@@ -191,6 +246,7 @@ ast_pipeline: pipeline {
             last = list_entry(list_back(&pipe->commands), struct cmd_helper, elem);
 
             $$ = ast_pipeline_create(
+                ctx->arena,
                 first->iored_input,
                 last->iored_output,
                 last->append_to_output
@@ -198,33 +254,35 @@ ast_pipeline: pipeline {
             for (struct list_elem * e = list_begin(&pipe->commands);
                                     e != list_end(&pipe->commands);) {
                 struct cmd_helper * cmd = list_entry(e, struct cmd_helper, elem);
-                ast_pipeline_add_command($$, make_ast_command(cmd));
+                ast_pipeline_add_command($$, make_ast_command(ctx, cmd));
                 e = list_remove(e);
-                free(cmd);
             }
-            free(pipe);
         }
 
 pipeline: command {
-            $$ = init_pipe();
-            if (!add_to_pipeline($$, $1, false))
+            $$ = init_pipe(ctx);
+            if (!add_to_pipeline(ctx, $$, $1, false))
                 YYABORT;
 		}
 |		pipeline '|' command {
-            if (!add_to_pipeline($1, $3, false))
+            if (!add_to_pipeline(ctx, $1, $3, false))
                 YYABORT;
             $$ = $1;
 		}
 |		pipeline PIPE_AMPERSAND command {
-            if (!add_to_pipeline($1, $3, true))
+            if (!add_to_pipeline(ctx, $1, $3, true))
                 YYABORT;
             $$ = $1;
 		}
-|		'|' error 	   { p_error(INVNUL); YYABORT; }
-|		pipeline '|' error { p_error(INVNUL); YYABORT; }
+|		'|' error 	   { p_error(ctx, INVNUL); YYABORT; }
+|		pipeline '|' error { p_error(ctx, INVNUL); YYABORT; }
 
 command:   WORD { 
-            $$ = init_cmd($1, NULL, NULL, false, false);
+            $$ = init_cmd(ctx, $1, NULL, NULL, false, false);
+        }
+|		PATTERN {
+            $$ = init_cmd(ctx, $1, NULL, NULL, false, false);
+            add_pattern(ctx, $$, $1);
         }
 |		input   
 |		output
@@ -232,70 +290,139 @@ command:   WORD {
             $$ = $1;
             obstack_ptr_grow(&$$->words, $2);
 		}
+|		command PATTERN {
+            $$ = $1;
+            obstack_ptr_grow(&$$->words, $2);
+            add_pattern(ctx, $$, $2);
+		}
 |		command input {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
-            if ($1->iored_input)   { p_error(AMBINP); YYABORT; }
+            if ($1->iored_input)   { p_error(ctx, AMBINP); YYABORT; }
             $$ = $1; 
             $$->iored_input = $2->iored_input;
-            free($2);
 		}
 |		command output {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
-            if ($1->iored_output) { p_error(AMBOUT); YYABORT; }
+            if ($1->iored_output) { p_error(ctx, AMBOUT); YYABORT; }
             $$ = $1; 
             $$->iored_output = $2->iored_output;
             $$->append_to_output = $2->append_to_output;
             $$->redirect_stderr = $2->redirect_stderr;
-            free($2);
 		}
 
-input:	'<' WORD { 
-            $$ = init_cmd(NULL, $2, NULL, false, false);
+/* Redirections take their file name as it is */
+word:	WORD
+|		PATTERN
+
+input:	'<' word { 
+            $$ = init_cmd(ctx, NULL, $2, NULL, false, false);
         }
-|		'<' error	  { p_error(MISRED); YYABORT; }
+|		'<' error	  { p_error(ctx, MISRED); YYABORT; }
 
-output:	'>' WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, false);
+output:	'>' word { 
+            $$ = init_cmd(ctx, NULL, NULL, $2, false, false);
         }
-|		GREATER_AMPERSAND WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, true);
+|		GREATER_AMPERSAND word { 
+            $$ = init_cmd(ctx, NULL, NULL, $2, false, true);
         }
-|		GREATER_GREATER WORD { 
-            $$ = init_cmd(NULL, NULL, $2, true, false);
+|		GREATER_GREATER word { 
+            $$ = init_cmd(ctx, NULL, NULL, $2, true, false);
         }
 		/* Error: missing redirect */
-|		'>' error 	  { p_error(MISRED); YYABORT; }
-|		GREATER_GREATER error { p_error(MISRED); YYABORT; }
+|		'>' error 	  { p_error(ctx, MISRED); YYABORT; }
+|		GREATER_GREATER error { p_error(ctx, MISRED); YYABORT; }
 
 %%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
-
-#define YY_NO_INPUT
 #include "lex.yy.c"
 
 static void
-p_error(char *msg) 
+p_error(struct ast_parse_context *ctx, const char *msg) 
 { 
-    /* print error */
-    fprintf(stderr, "%s\n", msg); 
+    /* remember the first error; the caller reports it */
+    if (ctx->error == NULL)
+        ctx->error = msg;
 }
 
-extern int yyparse (void);
-
 /* do not use default error handling since errors are handled above. */
 void 
-yyerror(const char *msg) { }
+yyerror(yyscan_t scanner, struct ast_parse_context *ctx, const char *msg) { }
+
+struct ast_parse_context *
+ast_parse_context_create(void)
+{
+    struct ast_parse_context *ctx = calloc(1, sizeof *ctx);
+    if (ctx == NULL)
+        return NULL;
+
+    if (yylex_init_extra(ctx, &ctx->scanner)) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+void
+ast_parse_context_destroy(struct ast_parse_context *ctx)
+{
+    yylex_destroy(ctx->scanner);
+    free(ctx);
+}
+
+const char *
+ast_parse_context_error(struct ast_parse_context *ctx)
+{
+    return ctx->error;
+}
 
-static struct ast_command_line * commandline;
-static void cmdline_complete(struct ast_command_line *cline)
+/*
+ * Parse a command line held in buf[0..len) using ctx, scanning it in
+ * place.  buf[len] and buf[len + 1] must both be '\0'; flex uses them
+ * to detect the end of the buffer.  The scanner temporarily writes
+ * into buf while matching tokens but leaves it as it was found.
+ * On a syntax error, returns NULL and ast_parse_context_error(ctx)
+ * describes the error.
+ */
+struct ast_command_line *
+ast_parse_command_buffer_r(struct ast_parse_context *ctx, char * buf, size_t len)
+{
+    assert(buf[len] == '\0' && buf[len + 1] == '\0');
+    YY_BUFFER_STATE input = yy_scan_buffer(buf, len + 2, ctx->scanner);
+    if (input == NULL)
+        return NULL;
+
+    ctx->commandline = NULL;
+    ctx->error = NULL;
+    ctx->arena = arena_create();
+
+    int error = yyparse(ctx->scanner, ctx);
+    /* drops any input left over after a syntax error, too */
+    yy_delete_buffer(input, ctx->scanner);
+    if (error) {
+        /* drops whatever was built before the error */
+        arena_destroy(ctx->arena);
+        return NULL;
+    }
+
+    return ctx->commandline;
+}
+
+/* Context used by the non-reentrant entry points below */
+static struct ast_parse_context *shell_ctx;
+
+/*
+ * Parse a command line in place, printing any error to stderr.
+ */
+struct ast_command_line *
+ast_parse_command_buffer(char * buf, size_t len)
 {
-    commandline = cline;
+    if (shell_ctx == NULL && (shell_ctx = ast_parse_context_create()) == NULL)
+        return NULL;
+
+    struct ast_command_line *cline;
+    cline = ast_parse_command_buffer_r(shell_ctx, buf, len);
+    if (shell_ctx->error)
+        fprintf(stderr, "%s\n", shell_ctx->error);
+    return cline;
 }
 
 /* 
@@ -304,10 +431,14 @@ static void cmdline_complete(struct ast_command_line *cline)
 struct ast_command_line *
 ast_parse_command_line(char * line)
 {
-    inputline = line;
-    commandline = NULL;
-
-    int error = yyparse();
-
-    return error ? NULL : commandline;
+    size_t len = strlen(line);
+    char *buf = malloc(len + 2);
+    if (buf == NULL)
+        return NULL;
+
+    memcpy(buf, line, len);
+    buf[len] = buf[len + 1] = '\0';
+    struct ast_command_line *cline = ast_parse_command_buffer(buf, len);
+    free(buf);
+    return cline;
 }
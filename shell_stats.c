@@ -0,0 +1,173 @@
+/*
+ * Latency histograms for the shell's own hot paths.
+ *
+ * A duration of v nanoseconds goes into one of 8 buckets between the
+ * powers of two around it: below 8 every value has its own bucket,
+ * above that the bucket is found from the position of v's highest
+ * bit and the 3 bits after it.  That needs no division or floating
+ * point, and 496 buckets cover everything up to 2^63 ns with a
+ * relative error of at most 1/8.  Percentiles are reported as the
+ * upper end of the bucket they fall into.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "shell_stats.h"
+
+#define SUB_BITS 3
+#define SUBS (1 << SUB_BITS)
+#define NBUCKETS ((63 - SUB_BITS + 2) * SUBS)
+
+struct histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[NBUCKETS];
+};
+
+static struct histogram histograms[STAT_COUNT];
+
+static const char *stat_names[STAT_COUNT] = {
+    [STAT_PARSE] = "parse",
+    [STAT_SPAWN] = "spawn",
+    [STAT_EXEC] = "exec",
+    [STAT_REAP] = "reap",
+    [STAT_PROMPT] = "prompt",
+};
+
+static inline int
+bucket_of(uint64_t v)
+{
+    if (v < SUBS)
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - SUB_BITS + 1) * SUBS + ((v >> (e - SUB_BITS)) & (SUBS - 1));
+}
+
+/* The smallest value in bucket b */
+static uint64_t
+bucket_low(int b)
+{
+    if (b < SUBS)
+        return b;
+    int e = b / SUBS + SUB_BITS - 1;
+    return (uint64_t) (SUBS + b % SUBS) << (e - SUB_BITS);
+}
+
+/* The largest value in bucket b */
+static uint64_t
+bucket_high(int b)
+{
+    return b == NBUCKETS - 1 ? UINT64_MAX : bucket_low(b + 1) - 1;
+}
+
+long long
+shell_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void
+shell_stats_record(enum shell_stat stat, long long ns)
+{
+    struct histogram *h = &histograms[stat];
+    uint64_t v = ns > 0 ? ns : 0;
+    h->buckets[bucket_of(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+void
+shell_stats_since(enum shell_stat stat, long long start)
+{
+    shell_stats_record(stat, shell_stats_now() - start);
+}
+
+/* The value below which 'pct' percent of the recorded values lie */
+static uint64_t
+percentile(const struct histogram *h, double pct)
+{
+    uint64_t rank = h->count * pct / 100, seen = 0;
+    for (int b = 0; b < NBUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank)
+            return bucket_high(b) < h->max ? bucket_high(b) : h->max;
+    }
+    return h->max;
+}
+
+/* Format a duration with a unit that keeps it short */
+static const char *
+format_ns(char *buf, size_t size, uint64_t ns)
+{
+    if (ns < 1000)
+        snprintf(buf, size, "%lluns", (unsigned long long) ns);
+    else if (ns < 1000000)
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, size, "%.2fs", ns / 1e9);
+    return buf;
+}
+
+void
+shell_stats_print(FILE *out)
+{
+    char p50[32], p90[32], p99[32], max[32];
+
+    fprintf(out, "%-8s %8s %9s %9s %9s %9s\n",
+            "", "count", "p50", "p90", "p99", "max");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+        fprintf(out, "%-8s %8llu %9s %9s %9s %9s\n", stat_names[i],
+                (unsigned long long) h->count,
+                format_ns(p50, sizeof p50, percentile(h, 50)),
+                format_ns(p90, sizeof p90, percentile(h, 90)),
+                format_ns(p99, sizeof p99, percentile(h, 99)),
+                format_ns(max, sizeof max, h->max));
+    }
+}
+
+void
+shell_stats_dump(FILE *out)
+{
+    fprintf(out, "{");
+    for (int i = 0; i < STAT_COUNT; i++) {
+        struct histogram *h = &histograms[i];
+        fprintf(out, "%s\n  \"%s\": {\"count\": %llu, \"sum_ns\": %llu, "
+                "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, "
+                "\"max_ns\": %llu, \"buckets\": [",
+                i ? "," : "", stat_names[i],
+                (unsigned long long) h->count, (unsigned long long) h->sum,
+                (unsigned long long) percentile(h, 50),
+                (unsigned long long) percentile(h, 90),
+                (unsigned long long) percentile(h, 99),
+                (unsigned long long) h->max);
+
+        /* Only the buckets that were used, as [lowest value, count] */
+        bool first = true;
+        for (int b = 0; b < NBUCKETS; b++) {
+            if (h->buckets[b] == 0)
+                continue;
+            fprintf(out, "%s[%llu, %llu]", first ? "" : ", ",
+                    (unsigned long long) bucket_low(b),
+                    (unsigned long long) h->buckets[b]);
+            first = false;
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n}\n");
+}
+
+void
+shell_stats_reset(void)
+{
+    memset(histograms, 0, sizeof histograms);
+}
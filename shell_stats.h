@@ -0,0 +1,39 @@
+#ifndef __SHELL_STATS_H
+#define __SHELL_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Latency histograms for the shell's own hot paths.  Each records
+ * durations in nanoseconds into logarithmic buckets, so recording is
+ * a few instructions and percentiles are accurate to within 1/8. */
+
+enum shell_stat {
+    STAT_PARSE,         /* readline handed over a line .. it is parsed */
+    STAT_SPAWN,         /* line parsed .. its first pipeline is spawned */
+    STAT_EXEC,          /* spawning one stage .. it runs its program */
+    STAT_REAP,          /* wait4 returned a child .. its job is updated */
+    STAT_PROMPT,        /* building and drawing the prompt */
+    STAT_COUNT
+};
+
+/* The current time in nanoseconds, from CLOCK_MONOTONIC */
+long long shell_stats_now(void);
+
+/* Record that 'stat' took 'ns' nanoseconds */
+void shell_stats_record(enum shell_stat stat, long long ns);
+
+/* Record that 'stat' took from 'start', a shell_stats_now() value,
+ * until now */
+void shell_stats_since(enum shell_stat stat, long long start);
+
+/* Print count, p50, p90, p99 and max of each histogram as a table */
+void shell_stats_print(FILE *out);
+
+/* Write every histogram, including its buckets, as JSON */
+void shell_stats_dump(FILE *out);
+
+/* Forget everything recorded so far */
+void shell_stats_reset(void);
+
+#endif /* __SHELL_STATS_H */
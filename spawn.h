@@ -90,6 +90,73 @@ extern int posix_spawnp (pid_t *__pid, const char *__file,
 			 char *const __argv[], char *const __envp[])
     __nonnull ((2, 5));
 
+#ifdef __USE_GNU
+/* Like `posix_spawn', but also store in *PIDFD a pidfd referring to the
+   new process.  The pidfd is created atomically with the process and has
+   FD_CLOEXEC set.  If the kernel cannot create pidfds, *PIDFD is set
+   to -1 and the process is still spawned.  */
+extern int posix_spawn_pidfd_np (pid_t *__restrict __pid,
+				 int *__restrict __pidfd,
+				 const char *__restrict __path,
+				 const posix_spawn_file_actions_t *__restrict
+				 __file_actions,
+				 const posix_spawnattr_t *__restrict __attrp,
+				 char *const __argv[__restrict_arr],
+				 char *const __envp[__restrict_arr])
+    __nonnull ((2, 3, 6));
+
+/* Similar to `posix_spawn_pidfd_np' but search for FILE in the PATH.  */
+extern int posix_spawnp_pidfd_np (pid_t *__pid, int *__pidfd,
+				  const char *__file,
+				  const posix_spawn_file_actions_t *__file_actions,
+				  const posix_spawnattr_t *__attrp,
+				  char *const __argv[], char *const __envp[])
+    __nonnull ((2, 3, 6));
+
+/* One stage of a pipeline started by `posix_spawn_pipeline_np'.  */
+typedef struct
+{
+  const char *file;		/* Program to run.  */
+  char *const *argv;
+  int (*fn) (char *const *__argv);	/* If not NULL, run FN (ARGV) in a
+				   forked copy of the caller instead of
+				   FILE, and exit with its result.  */
+  int use_path;			/* Search for FILE in the PATH.  */
+  const posix_spawn_file_actions_t *file_actions;	/* Performed after
+				   the stage's pipes are set up, or NULL.  */
+  pid_t pid;			/* Set to the new process, or -1.  */
+  int pidfd;			/* Set to a pidfd for it, or -1.  */
+  int error;			/* Set to 0, or why it was not spawned.  */
+  long long spawn_start_ns;	/* Set to the CLOCK_MONOTONIC time in
+				   nanoseconds its spawn started.  */
+  long long spawn_ns;		/* Set to the nanoseconds it took until
+				   the stage ran its program, or FN.  */
+} posix_spawn_stage_t;
+
+/* Spawn the NSTAGES stages of STAGES, each writing into a pipe read by
+   the next.  *ATTRP applies to every stage, except that if it sets
+   POSIX_SPAWN_SETPGROUP with a process group of 0, the first stage that
+   starts becomes the group leader and the others join its group, and
+   only that stage performs POSIX_SPAWN_TCSETPGROUP.  A stage that
+   cannot be spawned does not stop the others.  Return 0, or the error
+   that kept the remaining stages from being spawned.  */
+extern int posix_spawn_pipeline_np (posix_spawn_stage_t *__stages,
+				    int __nstages,
+				    const posix_spawnattr_t *__attrp,
+				    char *const __envp[])
+    __nonnull ((1));
+
+/* Enable or disable the reuse of child stacks between spawns.  Reuse
+   is enabled by default.  Disabling it releases the stacks kept.  */
+extern void posix_spawn_stack_pool_np (int __enable) __THROW;
+
+/* Select how children are created: "clone-vfork" (the default), "vfork",
+   "fork" or "clone3".  Return EINVAL if NAME is none of these.  */
+extern int posix_spawn_backend_np (const char *__name) __THROW;
+
+/* Return the name of the backend in use.  */
+extern const char *posix_spawn_backend_name_np (void) __THROW;
+#endif
 
 /* Initialize data structure with attributes for `spawn' to default values.  */
 extern int posix_spawnattr_init (posix_spawnattr_t *__attr)
@@ -74,6 +74,16 @@ extern int __spawni (pid_t *pid, const char *path,
 		     const posix_spawnattr_t *attrp, char *const argv[],
 		     char *const envp[], int xflags);
 
+extern int __spawni_pidfd (pid_t *pid, int *pidfd, const char *path,
+			   const posix_spawn_file_actions_t *file_actions,
+			   const posix_spawnattr_t *attrp, char *const argv[],
+			   char *const envp[], int xflags);
+
+extern int __spawni_call (pid_t *pid, int *pidfd, int (*call) (char *const *),
+			  const posix_spawn_file_actions_t *file_actions,
+			  const posix_spawnattr_t *attrp, char *const argv[],
+			  char *const envp[]);
+
 /* Return true if FD falls into the range valid for file descriptors.
    The check in this form is mandated by POSIX.  */
 bool __spawn_valid_fd (int fd);
@@ -0,0 +1,28 @@
+/* Spawn a process and obtain a pidfd for it at the same time.
+
+   These are extensions to the POSIX spawn interface.  A pidfd refers to
+   one particular process and cannot be confused with a later process
+   that happens to reuse the same pid.  */
+
+#define _GNU_SOURCE
+#include <spawn.h>
+#include "spawn_int.h"
+
+int
+posix_spawn_pidfd_np (pid_t *pid, int *pidfd, const char *path,
+		      const posix_spawn_file_actions_t *file_actions,
+		      const posix_spawnattr_t *attrp,
+		      char *const argv[], char *const envp[])
+{
+  return __spawni_pidfd (pid, pidfd, path, file_actions, attrp, argv, envp, 0);
+}
+
+int
+posix_spawnp_pidfd_np (pid_t *pid, int *pidfd, const char *file,
+		       const posix_spawn_file_actions_t *file_actions,
+		       const posix_spawnattr_t *attrp,
+		       char *const argv[], char *const envp[])
+{
+  return __spawni_pidfd (pid, pidfd, file, file_actions, attrp, argv, envp,
+			 SPAWN_XFLAGS_USE_PATH);
+}
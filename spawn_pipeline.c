@@ -0,0 +1,160 @@
+/* Spawn all stages of a pipeline with one call.
+
+   The stages are connected with pipes and started in one loop.  Process
+   group and terminal attributes are given once for the whole pipeline:
+   the first stage that starts becomes the group leader, the others join
+   its group, and only the leader takes the terminal.  */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include "spawn_int.h"
+
+/* The file actions of the stage being spawned.  The array is kept for
+   the next stage and the next pipeline and only ever grows, so after
+   the first pipeline no stage allocates.  */
+static __thread struct __spawn_action *stage_actions;
+static __thread int stage_allocated;
+
+/* Make room for N actions in the stage action array.  */
+static int
+stage_actions_reserve (int n)
+{
+  if (n <= stage_allocated)
+    return 0;
+
+  int allocated = stage_allocated ? stage_allocated : 8;
+  while (allocated < n)
+    allocated *= 2;
+  struct __spawn_action *actions = realloc (stage_actions,
+					    allocated * sizeof *actions);
+  if (actions == NULL)
+    return ENOMEM;
+  stage_actions = actions;
+  stage_allocated = allocated;
+  return 0;
+}
+
+/* Build the actions for a stage that reads from IN and writes to OUT
+   (-1 for either means the stage keeps the fd it inherits), followed by
+   the caller's actions for it.  */
+static int
+stage_actions_build (posix_spawn_file_actions_t *fa, int in, int out,
+		     const posix_spawn_file_actions_t *extra)
+{
+  int nextra = extra != NULL ? extra->__used : 0;
+  int ec = stage_actions_reserve (2 + nextra);
+  if (ec != 0)
+    return ec;
+
+  int n = 0;
+  if (in != -1)
+    {
+      stage_actions[n].tag = spawn_do_dup2;
+      stage_actions[n].action.dup2_action.fd = in;
+      stage_actions[n].action.dup2_action.newfd = STDIN_FILENO;
+      n++;
+    }
+  if (out != -1)
+    {
+      stage_actions[n].tag = spawn_do_dup2;
+      stage_actions[n].action.dup2_action.fd = out;
+      stage_actions[n].action.dup2_action.newfd = STDOUT_FILENO;
+      n++;
+    }
+  /* The copies share the path strings with EXTRA, which is why this
+     array is never passed to posix_spawn_file_actions_destroy.  */
+  if (nextra > 0)
+    memcpy (stage_actions + n, extra->__actions,
+	    nextra * sizeof *stage_actions);
+
+  memset (fa, 0, sizeof *fa);
+  fa->__allocated = stage_allocated;
+  fa->__used = n + nextra;
+  fa->__actions = stage_actions;
+  return 0;
+}
+
+int
+posix_spawn_pipeline_np (posix_spawn_stage_t *stages, int nstages,
+			 const posix_spawnattr_t *attrp, char *const envp[])
+{
+  posix_spawnattr_t attr;
+  if (attrp != NULL)
+    attr = *attrp;
+  else
+    posix_spawnattr_init (&attr);
+  int join_group = (attr.__flags & POSIX_SPAWN_SETPGROUP) != 0;
+  int ec = 0;
+
+  /* Each pipe is created just before the stage that writes to it and
+     closed as soon as the stage that reads from it has started, so the
+     number of open fds does not grow with the length of the
+     pipeline.  */
+  int prev_read = -1;
+  for (int i = 0; i < nstages; i++)
+    {
+      posix_spawn_stage_t *stage = &stages[i];
+      stage->pid = -1;
+      stage->pidfd = -1;
+      stage->spawn_start_ns = 0;
+      stage->spawn_ns = 0;
+      stage->error = ec;
+      if (ec != 0)
+	continue;
+
+      int fd[2] = { -1, -1 };
+      if (i < nstages - 1 && pipe2 (fd, O_CLOEXEC) != 0)
+	{
+	  ec = stage->error = errno;
+	  continue;
+	}
+
+      struct timespec start, end;
+      clock_gettime (CLOCK_MONOTONIC, &start);
+      posix_spawn_file_actions_t fa;
+      stage->error = stage_actions_build (&fa, prev_read, fd[1],
+					  stage->file_actions);
+      if (stage->error == 0 && stage->fn != NULL)
+	stage->error = __spawni_call (&stage->pid, &stage->pidfd, stage->fn,
+				      &fa, &attr, stage->argv, envp);
+      else if (stage->error == 0)
+	stage->error = __spawni_pidfd (&stage->pid, &stage->pidfd,
+				       stage->file, &fa, &attr,
+				       stage->argv, envp,
+				       stage->use_path
+				       ? SPAWN_XFLAGS_USE_PATH : 0);
+      if (stage->error != 0)
+	stage->pid = -1;
+      /* The spawn returns once the child has called execve, or once it
+	 has failed to.  */
+      clock_gettime (CLOCK_MONOTONIC, &end);
+      stage->spawn_start_ns = start.tv_sec * 1000000000LL + start.tv_nsec;
+      stage->spawn_ns = (end.tv_sec - start.tv_sec) * 1000000000LL
+			+ (end.tv_nsec - start.tv_nsec);
+
+      /* The first stage that started leads the process group.  */
+      if (stage->error == 0 && join_group)
+	{
+	  if (attr.__pgrp == 0)
+	    attr.__pgrp = stage->pid;
+	  attr.__flags &= ~POSIX_SPAWN_TCSETPGROUP;
+	  join_group = 0;
+	}
+
+      if (prev_read != -1)
+	close (prev_read);
+      if (fd[1] != -1)
+	close (fd[1]);
+      prev_read = fd[0];
+    }
+
+  if (prev_read != -1)
+    close (prev_read);
+  return ec;
+}
@@ -21,6 +21,7 @@
 #include "spawn.h"
 #include <fcntl.h>
 #include <paths.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
@@ -34,12 +35,14 @@
 #include <libc-pointer-arith.h>
 //#include <ldsodefs.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <sched.h>
 #include <signal.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/syscall.h>
 #define __pthread_setcancelstate pthread_setcancelstate
 #define __setpgid setpgid
 #define __getpgrp getpgrp
@@ -72,8 +75,8 @@
 // in lieu of <stackinfo.h>
 #define _STACK_GROWS_DOWN	1
 #include <elf.h>
-static int _dl_stack_flags = (PF_R|PF_W|PF_X);
-static const int _dl_pagesize = _SC_PAGESIZE;
+static int _dl_stack_flags = (PF_R|PF_W);
+#define _dl_pagesize ((size_t) sysconf (_SC_PAGESIZE))
 #define GL(name) _##name
 #define GLRO(name) _##name
 
@@ -134,13 +137,21 @@ _Static_assert (sizeof (posix_spawnattr_t) == 336,
 #define SPAWN_ERROR	127
 
 #ifdef __ia64__
-# define CLONE(__fn, __stackbase, __stacksize, __flags, __args) \
-  __clone2 (__fn, __stackbase, __stacksize, __flags, __args, 0, 0, 0)
+# define CLONE(__fn, __stackbase, __stacksize, __flags, __args, __ptid) \
+  __clone2 (__fn, __stackbase, __stacksize, __flags, __args, __ptid, 0, 0)
 #else
-# define CLONE(__fn, __stack, __stacksize, __flags, __args) \
-  __clone (__fn, __stack, __flags, __args)
+# define CLONE(__fn, __stack, __stacksize, __flags, __args, __ptid) \
+  __clone (__fn, __stack, __flags, __args, __ptid)
 #endif
 
+#ifndef CLONE_PIDFD
+# define CLONE_PIDFD 0x00001000
+#endif
+
+/* Cleared once the kernel turns out not to support CLONE_PIDFD, so that
+   later spawns do not try again.  */
+static bool clone_pidfd_supported = true;
+
 /* Since ia64 wants the stackbase w/clone2, re-use the grows-up macro.  */
 #if _STACK_GROWS_UP || defined (__ia64__)
 # define STACK(__stack, __stack_size) (__stack)
@@ -154,6 +165,7 @@ struct posix_spawn_args
   sigset_t oldmask;
   const char *file;
   int (*exec) (const char *, char *const *, char *const *);
+  int (*call) (char *const *);	/* Run instead of EXEC if not NULL.  */
   const posix_spawn_file_actions_t *fa;
   const posix_spawnattr_t *restrict attr;
   char *const *argv;
@@ -161,6 +173,8 @@ struct posix_spawn_args
   char *const *envp;
   int xflags;
   int err;
+  int errfd;	/* Where the child reports ERR if it does not share our
+		   memory, or -1.  */
 };
 
 /* Older version requires that shell script without shebang definition
@@ -374,6 +388,14 @@ __spawni_child (void *arguments)
   __sigprocmask (SIG_SETMASK, (attr->__flags & POSIX_SPAWN_SETSIGMASK)
 		 ? &attr->__ss : &args->oldmask, 0);
 
+  /* A function runs in the forked child instead of a new program.  Setup
+     is complete, so tell the parent not to wait for an exec.  */
+  if (args->call != NULL)
+    {
+      __close_nocancel (args->errfd);
+      _exit (args->call (args->argv));
+    }
+
   args->exec (args->file, args->argv, args->envp);
 
   /* This is compatibility function required to enable posix_spawn run
@@ -388,17 +410,319 @@ fail:
      be to set args->err to some negative sentinel and have the parent
      abort(), but that seems needlessly harsh.  */
   args->err = errno ? : ECHILD;
+  if (args->errfd != -1)
+    write (args->errfd, &args->err, sizeof args->err);
   _exit (SPAWN_ERROR);
 }
 
+/* Child stacks are kept for reuse instead of being unmapped after each
+   spawn.  Once CLONE_VFORK returns the child has exec'ed or exited and
+   no longer touches its stack, so the next spawn can use it as is.
+   Stacks are mapped with MAP_POPULATE, so the child does not fault in
+   its stack page by page either.
+
+   Each pool slot holds a page-aligned stack address with the stack's
+   size in pages in the low bits, or 0 if the slot is empty.  Slots are
+   claimed and filled with compare-and-swap, so concurrent spawns from
+   several threads, or from a signal handler, need no lock.  Stacks of
+   more than STACK_POOL_MAX_PAGES, needed only for huge argument lists,
+   are unmapped as before.  */
+#define STACK_POOL_SLOTS 16
+#define STACK_POOL_MAX_PAGES 64
+static uintptr_t stack_pool[STACK_POOL_SLOTS];
+static bool stack_pool_enabled = true;
+
+/* Take a pooled stack of at least SIZE bytes.  Returns NULL if there is
+   none, otherwise its base, with its actual size in *SIZEP.  */
+static void *
+stack_pool_get (size_t size, size_t *sizep)
+{
+  size_t pagesize = GLRO(dl_pagesize);
+  for (int i = 0; i < STACK_POOL_SLOTS; i++)
+    {
+      uintptr_t slot = __atomic_load_n (&stack_pool[i], __ATOMIC_RELAXED);
+      if (slot == 0 || (slot & (pagesize - 1)) * pagesize < size)
+	continue;
+      if (__atomic_compare_exchange_n (&stack_pool[i], &slot, 0, false,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+	  *sizep = (slot & (pagesize - 1)) * pagesize;
+	  return (void *) (slot & ~(pagesize - 1));
+	}
+    }
+  return NULL;
+}
+
+/* Return a stack to the pool.  Returns false if it does not fit, in
+   which case the caller must unmap it.  */
+static bool
+stack_pool_put (void *stack, size_t size)
+{
+  size_t pagesize = GLRO(dl_pagesize);
+  size_t pages = size / pagesize;
+  if (!stack_pool_enabled || pages > STACK_POOL_MAX_PAGES)
+    return false;
+
+  uintptr_t slot = (uintptr_t) stack | pages;
+  for (int i = 0; i < STACK_POOL_SLOTS; i++)
+    {
+      uintptr_t empty = 0;
+      if (__atomic_compare_exchange_n (&stack_pool[i], &empty, slot, false,
+				       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	return true;
+    }
+  return false;
+}
+
+void
+posix_spawn_stack_pool_np (int enable)
+{
+  stack_pool_enabled = enable;
+  if (enable)
+    return;
+
+  size_t pagesize = GLRO(dl_pagesize);
+  for (int i = 0; i < STACK_POOL_SLOTS; i++)
+    {
+      uintptr_t slot = __atomic_exchange_n (&stack_pool[i], 0,
+					    __ATOMIC_ACQUIRE);
+      if (slot != 0)
+	__munmap ((void *) (slot & ~(pagesize - 1)),
+		  (slot & (pagesize - 1)) * pagesize);
+    }
+}
+
+/* How __spawnix creates the child.  */
+enum spawn_backend
+{
+  SPAWN_BACKEND_CLONE_VFORK,	/* clone with CLONE_VM|CLONE_VFORK on a
+				   stack of the child's own */
+  SPAWN_BACKEND_VFORK,		/* vfork, child runs on our stack */
+  SPAWN_BACKEND_FORK,		/* fork, then exec */
+  SPAWN_BACKEND_CLONE3,		/* fork-like clone3 with CLONE_PIDFD */
+};
+
+static const char *const spawn_backend_names[] =
+{
+  [SPAWN_BACKEND_CLONE_VFORK] = "clone-vfork",
+  [SPAWN_BACKEND_VFORK] = "vfork",
+  [SPAWN_BACKEND_FORK] = "fork",
+  [SPAWN_BACKEND_CLONE3] = "clone3",
+};
+
+/* Chosen when libspawn is built; see the Makefile.  */
+#ifndef SPAWN_DEFAULT_BACKEND
+# define SPAWN_DEFAULT_BACKEND "clone-vfork"
+#endif
+
+/* The backend in use, or -1 until the first spawn picks one.  */
+static int spawn_backend = -1;
+
+static int
+spawn_backend_lookup (const char *name)
+{
+  for (int i = 0; i < sizeof spawn_backend_names / sizeof (char *); i++)
+    if (strcmp (name, spawn_backend_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+/* The SPAWN_BACKEND environment variable overrides the backend chosen
+   at build time, and posix_spawn_backend_np overrides both.  */
+static int
+spawn_backend_get (void)
+{
+  if (spawn_backend == -1)
+    {
+      const char *env = getenv ("SPAWN_BACKEND");
+      int backend = env != NULL ? spawn_backend_lookup (env) : -1;
+      if (backend == -1)
+	backend = spawn_backend_lookup (SPAWN_DEFAULT_BACKEND);
+      spawn_backend = backend == -1 ? SPAWN_BACKEND_CLONE_VFORK : backend;
+    }
+  return spawn_backend;
+}
+
+int
+posix_spawn_backend_np (const char *name)
+{
+  int backend = spawn_backend_lookup (name);
+  if (backend == -1)
+    return EINVAL;
+  spawn_backend = backend;
+  return 0;
+}
+
+const char *
+posix_spawn_backend_name_np (void)
+{
+  return spawn_backend_names[spawn_backend_get ()];
+}
+
+/* Return a pidfd for our child PID, which must not have been reaped
+   yet, or -1 if the kernel cannot provide one.  */
+static int
+spawn_pidfd_open (pid_t pid)
+{
+#ifdef SYS_pidfd_open
+  return syscall (SYS_pidfd_open, pid, 0);
+#else
+  return -1;
+#endif
+}
+
+/* Run __spawni_child in a new process that shares our memory, on a stack
+   of its own.  If PIDFD is not NULL, also try to obtain a pidfd for the
+   child.  */
+static pid_t
+spawn_clone_vfork (struct posix_spawn_args *args, int *pidfd)
+{
+  pid_t new_pid = -1;
+  int prot = (PROT_READ | PROT_WRITE
+	     | ((GL (dl_stack_flags) & PF_X) ? PROT_EXEC : 0));
+
+  /* Add a slack area for child's stack.  */
+  size_t argv_size = (args->argc * sizeof (void *)) + 512;
+  /* We need at least a few pages in case the compiler's stack checking is
+     enabled.  In some configs, it is known to use at least 24KiB.  We use
+     32KiB to be "safe" from anything the compiler might do.  Besides, the
+     extra pages won't actually be allocated unless they get used.  */
+  argv_size += (32 * 1024);
+  size_t stack_size = ALIGN_UP (argv_size, GLRO(dl_pagesize));
+  void *stack = stack_pool_enabled
+		? stack_pool_get (stack_size, &stack_size) : NULL;
+  if (stack == NULL)
+    {
+      bool poolable = stack_pool_enabled
+		      && stack_size / GLRO(dl_pagesize) <= STACK_POOL_MAX_PAGES;
+      stack = __mmap (NULL, stack_size, prot,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK
+		      | (poolable ? MAP_POPULATE : 0), -1, 0);
+      if (__glibc_unlikely (stack == MAP_FAILED))
+	return -1;
+    }
+
+  /* The clone flags used will create a new child that will run in the same
+     memory space (CLONE_VM) and the execution of calling thread will be
+     suspend until the child calls execve or _exit.
+
+     Also since the calling thread execution will be suspend, there is not
+     need for CLONE_SETTLS.  Although parent and child share the same TLS
+     namespace, there will be no concurrent access for TLS variables (errno
+     for instance).
+
+     If the caller asked for a pidfd, CLONE_PIDFD has the kernel create it
+     together with the child and store it in *PIDFD.  Kernels before 5.2
+     ignore the flag and leave *PIDFD alone; kernels that know the flag
+     but refuse it fail with EINVAL, in which case we retry without.  */
+  int flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+  if (pidfd != NULL && clone_pidfd_supported)
+    {
+      new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
+		       flags | CLONE_PIDFD, args, pidfd);
+      if (new_pid == -1 && errno == EINVAL)
+	clone_pidfd_supported = false;
+      else if (new_pid > 0 && *pidfd == -1)
+	clone_pidfd_supported = false;
+    }
+
+  if (new_pid == -1 && (pidfd == NULL || !clone_pidfd_supported))
+    new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
+		     flags, args, NULL);
+
+  int saved_errno = errno;
+  if (!stack_pool_put (stack, stack_size))
+    __munmap (stack, stack_size);
+  errno = saved_errno;
+  return new_pid;
+}
+
+/* Run __spawni_child in a vfork'ed child.  The child borrows our stack,
+   which is safe only because __spawni_child never returns.  */
+static pid_t
+spawn_vfork (struct posix_spawn_args *args, int *pidfd)
+{
+  pid_t new_pid = vfork ();
+  if (new_pid == 0)
+    __spawni_child (args);
+
+  if (new_pid > 0 && pidfd != NULL)
+    *pidfd = spawn_pidfd_open (new_pid);
+  return new_pid;
+}
+
+/* Layout of struct clone_args as of Linux 5.3.  */
+struct spawn_clone_args
+{
+  uint64_t flags;
+  uint64_t pidfd;
+  uint64_t child_tid;
+  uint64_t parent_tid;
+  uint64_t exit_signal;
+  uint64_t stack;
+  uint64_t stack_size;
+  uint64_t tls;
+};
+
+/* Run __spawni_child in a child that gets a copy of our memory, created
+   with fork, or with clone3 if USE_CLONE3 so that the kernel creates the
+   pidfd together with the child.  As the child cannot set ARGS->err for
+   us, it reports errors through a close-on-exec pipe instead: if the pipe
+   is closed without data, the exec succeeded.  */
+static pid_t
+spawn_fork (struct posix_spawn_args *args, int *pidfd, bool use_clone3)
+{
+  int errpipe[2];
+  if (pipe2 (errpipe, O_CLOEXEC) != 0)
+    return -1;
+  args->errfd = errpipe[1];
+
+  pid_t new_pid = -1;
+#ifdef SYS_clone3
+  if (use_clone3)
+    {
+      struct spawn_clone_args cl_args = {
+	.flags = pidfd != NULL ? CLONE_PIDFD : 0,
+	.pidfd = (uintptr_t) pidfd,
+	.exit_signal = SIGCHLD,
+      };
+      new_pid = syscall (SYS_clone3, &cl_args, sizeof cl_args);
+      if (new_pid == -1 && errno == ENOSYS)
+	use_clone3 = false;
+    }
+#else
+  use_clone3 = false;
+#endif
+  if (!use_clone3)
+    new_pid = fork ();
+
+  if (new_pid == 0)
+    __spawni_child (args);
+
+  int saved_errno = errno;
+  __close_nocancel (errpipe[1]);
+  if (new_pid > 0)
+    {
+      int err;
+      if (read (errpipe[0], &err, sizeof err) == sizeof err)
+	args->err = err;
+      if (!use_clone3 && pidfd != NULL)
+	*pidfd = spawn_pidfd_open (new_pid);
+    }
+  __close_nocancel (errpipe[0]);
+  errno = saved_errno;
+  return new_pid;
+}
+
 /* Spawn a new process executing PATH with the attributes describes in *ATTRP.
    Before running the process perform the actions described in FILE-ACTIONS. */
 static int
-__spawnix (pid_t * pid, const char *file,
+__spawnix (pid_t * pid, int *pidfd, const char *file,
 	   const posix_spawn_file_actions_t * file_actions,
 	   const posix_spawnattr_t * attrp, char *const argv[],
 	   char *const envp[], int xflags,
-	   int (*exec) (const char *, char *const *, char *const *))
+	   int (*exec) (const char *, char *const *, char *const *),
+	   int (*call) (char *const *))
 {
   pid_t new_pid;
   struct posix_spawn_args args;
@@ -421,31 +745,17 @@ __spawnix (pid_t * pid, const char *file,
 	return errno;
       }
 
-  int prot = (PROT_READ | PROT_WRITE
-	     | ((GL (dl_stack_flags) & PF_X) ? PROT_EXEC : 0));
-
-  /* Add a slack area for child's stack.  */
-  size_t argv_size = (argc * sizeof (void *)) + 512;
-  /* We need at least a few pages in case the compiler's stack checking is
-     enabled.  In some configs, it is known to use at least 24KiB.  We use
-     32KiB to be "safe" from anything the compiler might do.  Besides, the
-     extra pages won't actually be allocated unless they get used.  */
-  argv_size += (32 * 1024);
-  size_t stack_size = ALIGN_UP (argv_size, GLRO(dl_pagesize));
-  void *stack = __mmap (NULL, stack_size, prot,
-			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-  if (__glibc_unlikely (stack == MAP_FAILED))
-    return errno;
-
   /* Disable asynchronous cancellation.  */
   int state;
   __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
 
   /* Child must set args.err to something non-negative - we rely on
-     the parent and child sharing VM.  */
+     the parent and child sharing VM, or on the error pipe.  */
   args.err = 0;
+  args.errfd = -1;
   args.file = file;
   args.exec = exec;
+  args.call = call;
   args.fa = file_actions;
   args.attr = attrp ? attrp : &(const posix_spawnattr_t) { 0 };
   args.argv = argv;
@@ -455,16 +765,24 @@ __spawnix (pid_t * pid, const char *file,
 
   __libc_signal_block_all (&args.oldmask);
 
-  /* The clone flags used will create a new child that will run in the same
-     memory space (CLONE_VM) and the execution of calling thread will be
-     suspend until the child calls execve or _exit.
-
-     Also since the calling thread execution will be suspend, there is not
-     need for CLONE_SETTLS.  Although parent and child share the same TLS
-     namespace, there will be no concurrent access for TLS variables (errno
-     for instance).  */
-  new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
-		   CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  int new_pidfd = -1;
+  int *pidfdp = pidfd != NULL ? &new_pidfd : NULL;
+  /* A function needs a copy of our memory to run in.  */
+  switch (call != NULL ? SPAWN_BACKEND_FORK : spawn_backend_get ())
+    {
+    case SPAWN_BACKEND_VFORK:
+      new_pid = spawn_vfork (&args, pidfdp);
+      break;
+    case SPAWN_BACKEND_FORK:
+      new_pid = spawn_fork (&args, pidfdp, false);
+      break;
+    case SPAWN_BACKEND_CLONE3:
+      new_pid = spawn_fork (&args, pidfdp, true);
+      break;
+    default:
+      new_pid = spawn_clone_vfork (&args, pidfdp);
+      break;
+    }
 
   /* It needs to collect the case where the auxiliary process was created
      but failed to execute the file (due either any preparation step or
@@ -488,13 +806,19 @@ __spawnix (pid_t * pid, const char *file,
 	__waitpid (new_pid, NULL, 0);
     }
   else
-    ec = -new_pid;
-
-  __munmap (stack, stack_size);
+    ec = errno;
 
   if ((ec == 0) && (pid != NULL))
     *pid = new_pid;
 
+  if (pidfd != NULL)
+    {
+      if (ec == 0)
+	*pidfd = new_pidfd;
+      else if (new_pidfd != -1)
+	__close_nocancel (new_pidfd);
+    }
+
   __libc_signal_restore_set (&args.oldmask);
 
   __pthread_setcancelstate (state, NULL);
@@ -512,6 +836,30 @@ __spawni (pid_t * pid, const char *file,
 {
   /* It uses __execvpex to avoid run ENOEXEC in non compatibility mode (it
      will be handled by maybe_script_execute).  */
-  return __spawnix (pid, file, acts, attrp, argv, envp, xflags,
-		    xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex :__execve);
+  return __spawnix (pid, NULL, file, acts, attrp, argv, envp, xflags,
+		    xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex :__execve, NULL);
+}
+
+/* Like __spawni, but also return a pidfd for the new process in *PIDFD,
+   or -1 if the kernel cannot provide one.  */
+int
+__spawni_pidfd (pid_t * pid, int *pidfd, const char *file,
+		const posix_spawn_file_actions_t * acts,
+		const posix_spawnattr_t * attrp, char *const argv[],
+		char *const envp[], int xflags)
+{
+  return __spawnix (pid, pidfd, file, acts, attrp, argv, envp, xflags,
+		    xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex :__execve, NULL);
+}
+
+/* Like __spawni_pidfd, but run CALL (ARGV) in a forked child instead of
+   executing a file, and exit with its result.  */
+int
+__spawni_call (pid_t * pid, int *pidfd, int (*call) (char *const *),
+	       const posix_spawn_file_actions_t * acts,
+	       const posix_spawnattr_t * attrp, char *const argv[],
+	       char *const envp[])
+{
+  return __spawnix (pid, pidfd, argv[0], acts, attrp, argv, envp, 0,
+		    __execve, call);
 }
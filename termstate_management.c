@@ -16,6 +16,8 @@
 #include "termstate_management.h"
 #include "utils.h"
 #include "signal_support.h"
+#include "shell_stats.h"
+#include "trace.h"
 
 static int terminal_fd = -1;           /* The controlling terminal */
 static struct termios saved_tty_state; /* The state of the terminal when shell
@@ -90,6 +92,12 @@ termstate_get_tty_fd(void)
 void
 termstate_give_terminal_to(struct termios *pg_tty_state, pid_t pgrp)
 {
+    if (trace_enabled()) {
+        char args[32];
+        snprintf(args, sizeof args, "{\"pgrp\":%d}", pgrp);
+        trace_instant(getpid(), "terminal", shell_stats_now(), args);
+    }
+
     signal_block(SIGTTOU);
     int rc = tcsetpgrp(termstate_get_tty_fd(), pgrp);
     if (rc == -1)
@@ -0,0 +1,86 @@
+#!/usr/bin/python
+#
+# Tests admission control: background jobs over the limit set with
+# "queue -j" wait in the run queue and start as slots free up, in
+# order of priority, and fg starts a queued job right away.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+
+setup_tests()
+
+sendline("queue -j 1")
+sendline("queue")
+expect("jobs +1")
+
+# The first job runs, the others wait
+sendline("sleep 30 &")
+expect("\\[1\\] \\d+")
+sendline("sleep 30 &")
+expect("\\[2\\] queued")
+sendline("echo second done &")
+expect("\\[3\\] queued")
+
+# Job 3 is moved ahead of job 2
+sendline("queue -p 5 3")
+sendline("queue")
+expect("\\[3\\]\t5\t\t\\(echo second done\\)")
+expect("\\[2\\]\t0\t\t\\(sleep 30\\)")
+sendline("jobs")
+expect("\\[1\\]\tRunning")
+expect("\\[2\\]\tQueued")
+expect("\\[3\\]\tQueued")
+
+# When job 1 ends, job 3 starts before job 2
+sendline("kill 1")
+expect("\\[1\\]\tDone")
+expect("second done")
+sendline("jobs")
+expect("\\[2\\]\tRunning")
+sendline("kill 2")
+expect("\\[2\\]\tDone")
+
+# Foreground jobs are not limited
+sendline("sleep 1")
+sendline("sleep 30 &")
+expect("\\[1\\] \\d+")
+sendline("echo ran in foreground")
+expect("ran in foreground")
+
+# fg lets a queued job skip the queue
+sendline("sleep 30 &")
+expect("\\[2\\] queued")
+sendline("echo first queued &")
+expect("\\[3\\] queued")
+sendline("fg 3")
+expect("first queued")
+
+# kill takes a job out of the queue without running it
+sendline("jobs")
+expect("\\[2\\]\tQueued")
+sendline("kill 2")
+sendline("kill 1")
+expect("\\[1\\]\tDone")
+
+# kill in the background still runs in the shell, so the queued job
+# is really dropped and its job id is free again; in a pipeline it
+# is refused
+sendline("sleep 30 &")
+expect("\\[1\\] \\d+")
+sendline("sleep 30 &")
+expect("\\[2\\] queued")
+sendline("kill 2 &")
+sendline("sleep 30 &")
+expect("\\[2\\] queued")
+sendline("jobs | kill 2")
+expect("kill: cannot run in a pipeline")
+sendline("kill 2")
+sendline("kill 1")
+expect("\\[1\\]\tDone")
+sendline("queue -j 0")
+sendline("queue")
+expect("jobs +off")
+
+test_success()
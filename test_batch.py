@@ -0,0 +1,40 @@
+#!/usr/bin/python
+#
+# Tests the batch builtin, which runs a command with as many words
+# as fit into its arguments, like xargs.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+
+setup_tests()
+
+# All words fit into one command
+sendline("batch echo ::: a b c d")
+expect("a b c d")
+
+# -n limits the words per command
+sendline("batch -n 2 echo ::: 1 2 3")
+expect("1 2\r\n3")
+
+# -s limits the bytes of arguments per command
+sendline("batch -s 40 echo x ::: aaaaaaaa bbbbbbbb")
+expect("x aaaaaaaa\r\nx bbbbbbbb")
+
+# Far more words than one execve takes are split over few commands,
+# none of which fails with E2BIG
+with open("batch_words.txt", "w") as f:
+    for i in range(300000):
+        f.write("word%d\n" % i)
+sendline("batch -j 2 sh -c \"echo $#\" sh < batch_words.txt > batch_counts.txt")
+sendline("printf \"%s-%s\\n\" batch finished")
+expect("batch-finished")
+with open("batch_counts.txt") as f:
+    counts = [int(line) for line in f]
+os.unlink("batch_words.txt")
+os.unlink("batch_counts.txt")
+assert sum(counts) == 300000, "words were lost: %s" % counts
+assert len(counts) < 10, "too many commands: %d" % len(counts)
+
+test_success()
@@ -0,0 +1,46 @@
+#!/usr/bin/python
+#
+# Tests builtins as stages of a pipeline and builtins with redirection.
+# A builtin in a pipeline runs in a child of the shell; a builtin on
+# its own runs in the shell with its stdout redirected while it runs.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+
+setup_tests()
+
+sendline("echo marker_one")
+expect("marker_one")
+
+# The output of a builtin can feed another command
+sendline("history | grep marker_one | wc -l")
+expect("2")
+
+# A builtin can be the last stage, and 'jobs' does not report the
+# pipeline it runs in
+sendline("sleep 2 &")
+sendline("echo ignored | jobs")
+expect("sleep 2")
+
+sendline("jobs | tr a-z A-Z")
+expect("SLEEP 2")
+
+# Redirection applies to a builtin on its own, and the shell's own
+# stdout is restored afterwards
+sendline("jobs > builtin_out.txt")
+sendline("cat builtin_out.txt")
+expect("sleep 2")
+sendline("echo restored")
+expect("restored")
+
+# A builtin on its own still changes the shell's state
+sendline("cd /tmp > /dev/null")
+sendline("pwd")
+expect("/tmp")
+sendline("cd " + os.getcwd())
+
+sendline("rm builtin_out.txt")
+
+test_success()
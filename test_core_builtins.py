@@ -0,0 +1,63 @@
+#!/usr/bin/python
+#
+# Tests the echo, printf, test, [, true, false and pwd builtins, which
+# the shell runs itself instead of spawning the external commands.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+import subprocess
+from testutils import *
+
+
+setup_tests()
+
+sendline("type echo printf test [ true false pwd")
+for name in ["echo", "printf", "test", "\\[", "true", "false", "pwd"]:
+    expect(name + " is a shell builtin")
+
+sendline("echo -n first; echo second")
+expect("firstsecond")
+sendline("echo -e a\\tb")
+expect("a\tb")
+
+sendline("printf [%5s][%-3d][%x]\\n abc 7 255")
+expect("\\[  abc\\]\\[7  \\]\\[ff\\]")
+sendline("printf %s- a b c")
+expect("a-b-c-")
+
+# Builtins work in pipelines and with redirection
+sendline("echo redirected > core_builtins_out.txt")
+sendline("cat core_builtins_out.txt")
+expect("redirected")
+sendline("rm core_builtins_out.txt")
+
+sendline("pwd | tr / _")
+expect(os.getcwd().replace("/", "_"))
+
+# Exit statuses, as cush -c passes on the status of its last command:
+# 0 if an expression is true, 1 if it is false, 2 if it is malformed
+statuses = [
+    ("true", 0),
+    ("false", 1),
+    ("test 1 -lt 2", 0),
+    ("test 2 -lt 1", 1),
+    ("[ a = a ]", 0),
+    ("[ a = b ]", 1),
+    ("[ ! -d / ]", 1),
+    ("test -d / -a -n x", 0),
+    ("test -n \"\"", 1),
+    ("test", 1),
+    ("test 1 -lt x", 2),
+    ("[ a = a", 2),
+    ("true; false", 1),
+    ("false; true", 0),
+    ("true | false", 1),
+]
+for cmdline, status in statuses:
+    result = subprocess.call(["./cush", "-c", cmdline],
+                             stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    if result != status:
+        print("cush -c '%s' exited with %d, expected %d" % (cmdline, result, status))
+        sys.exit(1)
+
+test_success()
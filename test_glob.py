@@ -0,0 +1,58 @@
+#!/usr/bin/python
+#
+# Tests pathname expansion: matches come out sorted, quoted words and
+# patterns that match nothing are left alone, and a directory that
+# changes is read again.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+import tempfile, shutil, subprocess
+
+
+setup_tests()
+
+tmpdir = tempfile.mkdtemp("-cush-glob")
+atexit.register(lambda: shutil.rmtree(tmpdir))
+for f in ['b.c', 'a.c', '.hidden.c', 'notes.txt']:
+    open(os.path.join(tmpdir, f), "w")
+os.mkdir(os.path.join(tmpdir, "sub"))
+open(os.path.join(tmpdir, "sub", "c.c"), "w")
+time.sleep(0.1)
+
+sendline("cd " + tmpdir)
+
+# Sorted, and wildcards do not match a leading '.'
+sendline("echo *.c ?otes.[st]xt")
+expect("a.c b.c notes.txt\r\n")
+sendline("echo */")
+expect("sub/\r\n")
+sendline("echo */*.c")
+expect("sub/c.c\r\n")
+
+# Quoted patterns and patterns without matches stay as they are
+sendline("echo \"*.c\" \"?.c\" *.none")
+expect("\\*.c \\?.c \\*.none\r\n")
+
+# The listing cached above is read again once the directory changes
+sendline("echo *.c")
+expect("a.c b.c\r\n")
+sendline("touch 0.c")
+sendline("echo *.c")
+expect("0.c a.c b.c\r\n")
+sendline("rm a.c")
+sendline("echo *.c")
+expect("0.c b.c\r\n")
+
+# [ is still the test builtin, and its own name is not expanded even
+# though it looks like the start of a bracket expression; its operands
+# are, as for any other command
+cush = os.path.abspath("cush")
+for cmdline, status in [("[ 1 -eq 1 ]", 0), ("[ 1 -eq 2 ]", 1),
+                        ("[ -f n*.txt ]", 0), ("[ -f *.none ]", 1)]:
+    result = subprocess.call([cush, "-c", cmdline], cwd=tmpdir)
+    if result != status:
+        print("cush -c '%s' exited with %d, expected %d" % (cmdline, result, status))
+        sys.exit(1)
+
+test_success()
@@ -0,0 +1,75 @@
+#!/usr/bin/python
+#
+# Tests the command hash table: hash lists the commands the shell has
+# looked up, hash -r forgets them, type tells whether a command is
+# hashed, and an entry is dropped once a PATH directory that could
+# shadow it changes.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+import tempfile, shutil
+
+
+# Two PATH directories in front of the usual ones; mycmd is only in
+# the second, until one is added to the first.
+tmpdir = tempfile.mkdtemp("-cush-hash")
+atexit.register(lambda: shutil.rmtree(tmpdir))
+first = os.path.join(tmpdir, "first")
+second = os.path.join(tmpdir, "second")
+os.mkdir(first)
+os.mkdir(second)
+
+def make_command(dir, output):
+    path = os.path.join(dir, "mycmd")
+    with open(path, "w") as f:
+        f.write("#!/bin/sh\necho %s\n" % output)
+    os.chmod(path, 0o755)
+    return path
+
+second_cmd = make_command(second, "from-second")
+os.environ["PATH"] = first + ":" + second + ":" + os.environ["PATH"]
+
+setup_tests()
+
+sendline("hash -r")
+sendline("hash")
+expect("hash: hash table empty")
+
+sendline("mycmd")
+expect("from-second")
+sendline("mycmd")
+expect("from-second")
+sendline("hash")
+expect("hits\tcommand")
+expect("\\s+2\t" + second_cmd)
+sendline("type mycmd")
+expect("mycmd is hashed \\(" + second_cmd + "\\)")
+
+# hash -r forgets everything; hash names looks them up again
+sendline("hash -r")
+sendline("hash")
+expect("hash: hash table empty")
+sendline("hash mycmd")
+sendline("type mycmd")
+expect("mycmd is hashed \\(" + second_cmd + "\\)")
+
+# A new mycmd in the first directory changes that directory, so the
+# entry for the second one must not be used any more
+time.sleep(0.1)
+first_cmd = make_command(first, "from-first")
+sendline("mycmd")
+expect("from-first")
+sendline("type mycmd")
+expect("mycmd is hashed \\(" + first_cmd + "\\)")
+
+# Removing it changes the directory again
+time.sleep(0.1)
+os.unlink(first_cmd)
+sendline("mycmd")
+expect("from-second")
+
+sendline("type nosuchcommand-cush")
+expect("type: nosuchcommand-cush: not found")
+
+test_success()
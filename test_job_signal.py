@@ -0,0 +1,34 @@
+#!/usr/bin/python
+#
+# Tests stop, bg and kill on jobs whose first process, the leader of
+# their process group, has already exited and been reaped.  The other
+# processes must still get the signals.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+
+setup_tests()
+
+# The first stage exits at once, the second keeps the group alive
+sendline("sleep 0.2 | sleep 100 &")
+expect("\\[1\\] \\d+")
+time.sleep(1)
+
+sendline("stop 1")
+sendline("jobs")
+expect("\\[1\\]\tStopped")
+sendline("bg 1")
+sendline("jobs")
+expect("\\[1\\]\tRunning")
+sendline("kill 1")
+expect("\\[1\\]\tDone")
+
+# The same for a parallel job whose first command is done
+sendline("parallel -j 2 sleep ::: 0.2 100 &")
+time.sleep(1)
+sendline("kill 1")
+expect("\\[1\\]\tDone")
+
+test_success()
@@ -0,0 +1,43 @@
+#!/usr/bin/python
+#
+# Tests pipelines with more stages than the shell used to support.
+# The shell closes each pipe as soon as the next stage has been
+# spawned, so a long pipeline must not run out of file descriptors.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+import tempfile, shutil
+
+
+setup_tests()
+
+# A pipeline longer than the old fixed limit of 20 stages
+sendline("echo short " + "| cat " * 25 + "| tr a-z A-Z")
+expect("SHORT")
+
+# 5000 stages would need 10000 pipe fds if they were all kept open
+sendline("echo long " + "| cat " * 5000 + "| tr a-z A-Z")
+expect("LONG", timeout=60)
+
+# Redirection still applies to the first and last stage only
+sendline("echo redirected | cat | cat > pipeline_out.txt")
+sendline("cat < pipeline_out.txt | tr a-z A-Z")
+expect("REDIRECTED")
+sendline("rm pipeline_out.txt")
+
+# Commands found through a relative PATH directory are not cached, so
+# each stage must keep its own copy of the path until all are spawned
+tmpdir = tempfile.mkdtemp("-cush-pipeline")
+atexit.register(lambda: shutil.rmtree(tmpdir))
+for name, body in [("upper", "tr a-z A-Z"), ("tagged", "sed s/^/tag-/")]:
+    path = os.path.join(tmpdir, name)
+    with open(path, "w") as f:
+        f.write("#!/bin/sh\nexec %s\n" % body)
+    os.chmod(path, 0o755)
+sendline("cd " + tmpdir)
+sendline("env PATH=.:/usr/bin:/bin %s -c \"echo relative | upper | tagged\""
+         % os.path.abspath("cush"))
+expect("tag-RELATIVE")
+
+test_success()
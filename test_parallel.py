@@ -0,0 +1,62 @@
+#!/usr/bin/python
+#
+# Tests the parallel builtin, which runs a command once per argument
+# with a bounded number running at a time, all as a single job.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+
+setup_tests()
+
+# {} is replaced by each argument
+sendline("parallel -j 2 echo item-{} ::: a b c")
+expect("item-")
+expect("item-")
+expect("item-")
+
+# Arguments from stdin, one per line, appended if there is no {}
+with open("parallel_args.txt", "w") as f:
+    f.write("x\ny\n")
+sendline("parallel -j 1 echo arg < parallel_args.txt")
+expect("arg x")
+expect("arg y")
+os.unlink("parallel_args.txt")
+
+# With -g the output of each command comes out in one piece
+sendline("parallel -g -j 2 sh -c \"echo begin {}; sleep 0.{}; echo end {}\" ::: 4 1")
+expect("begin 1\r\nend 1\r\nbegin 4\r\nend 4")
+
+# All commands are one job that stop, bg and kill act on
+sendline("parallel -j 2 sleep ::: 30 30 30 30 &")
+expect("\\[1\\] \\d+")
+sendline("jobs -l")
+expect("parallel -j 2 sleep ::: 30 30 30 30")
+expect("\\d+ +sleep")
+expect("\\d+ +sleep")
+expect("total")
+sendline("stop 1")
+sendline("jobs")
+expect("\\[1\\]\tStopped")
+sendline("bg 1")
+sendline("kill 1")
+expect("\\[1\\]\tDone")
+sendline("jobs")
+sendline("echo no jobs left")
+expect("no jobs left")
+
+# A stopped job whose command was killed has no processes but more
+# commands to run.  kill completes it, and fg must not complete it again.
+sendline("parallel -j 1 sleep ::: 1234 1235 &")
+time.sleep(0.5)
+sendline("stop 1")
+time.sleep(0.3)
+sendline("pkill -KILL -f \"sleep 1234\"")
+time.sleep(0.5)
+sendline("kill 1; fg 1")
+expect("fg: no such job")
+sendline("printf %s-%s\\n still running")
+expect("still-running")
+
+test_success()
@@ -0,0 +1,34 @@
+#!/usr/bin/python
+#
+# Tests the source builtin.  Scripts are parsed on worker threads,
+# but their lines must still run in order, and parse errors must be
+# reported when the line that contains them is reached.
+#
+
+import sys, imp, atexit, pexpect, proc_check, signal, time, threading
+from testutils import *
+
+
+setup_tests()
+
+# Spread the commands over several blocks of the script by padding
+# with blank lines.
+with open("source_test.sh", "w") as script:
+    for i in range(1, 21):
+        script.write("echo %d >> source_out.txt\n" % i)
+        script.write((" " * 40 + "\n") * 100)
+    script.write("echo before\n")
+    script.write("ls >\n")
+    script.write("echo after\n")
+
+sendline("source source_test.sh")
+expect("before")
+expect("Missing name for redirect.")
+expect("after")
+
+sendline("paste -s -d , source_out.txt")
+expect(",".join(str(i) for i in range(1, 21)))
+
+sendline("rm source_test.sh source_out.txt")
+
+test_success()
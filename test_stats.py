@@ -0,0 +1,32 @@
+#!/usr/bin/python
+#
+# Tests the stats builtin, which reports the latency histograms the
+# shell keeps for its own hot paths.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading, json
+from testutils import *
+
+
+setup_tests()
+
+sendline("true | cat")
+sendline("stats")
+expect("count +p50 +p90 +p99 +max")
+for name in ["parse", "spawn", "exec", "reap", "prompt"]:
+    expect(name + " +\\d+ +[\\d.]+[nums]+s")
+
+sendline("stats -o stats_out.json")
+sendline("echo written")
+expect("written")
+with open("stats_out.json") as f:
+    stats = json.load(f)
+assert stats["exec"]["count"] >= 2, "two stages were spawned"
+assert stats["exec"]["p50_ns"] <= stats["exec"]["max_ns"]
+os.unlink("stats_out.json")
+
+sendline("stats -r")
+sendline("stats | grep exec")
+expect("exec +0 ")
+
+test_success()
@@ -0,0 +1,40 @@
+#!/usr/bin/python
+#
+# Tests the time prefix, which reports what a pipeline took once per
+# stage, and jobs -l, which shows what each job has used so far.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading
+import re, subprocess
+from testutils import *
+
+
+setup_tests()
+
+sendline("time sleep 0.5 | cat")
+expect("real 0\\.[5-9]\\d\\ds user \\d+\\.\\d+s sys \\d+\\.\\d+s maxrss \\d+K ctxsw \\d+/\\d+")
+expect("1 sleep +real 0\\.[5-9]")
+expect("2 cat +real 0\\.[5-9]")
+
+sendline("time echo timed")
+expect("timed")
+expect("real \\d+\\.\\d+s user")
+
+sendline("sleep 30 | cat &")
+expect("\\[1\\] \\d+")
+sendline("jobs -l")
+expect("\\(sleep 30\\| cat\\)")
+expect("\\d+ +sleep +user \\d+\\.\\d+s sys \\d+\\.\\d+s maxrss \\d+K ctxsw \\d+/\\d+")
+expect("\\d+ +cat +user")
+expect("total +user")
+sendline("kill 1")
+
+# The last command of cush -c normally replaces the shell, but a timed
+# one must not, or its report would never be printed
+output = subprocess.check_output(["./cush", "-c", "time sleep 0.2"],
+                                 stderr=subprocess.STDOUT).decode()
+if not re.search("real 0\\.[2-9]\\d\\ds user", output):
+    print("cush -c 'time sleep 0.2' printed %r" % output)
+    sys.exit(1)
+
+test_success()
@@ -0,0 +1,42 @@
+#!/usr/bin/python
+#
+# Tests trace on/off, which writes the lifecycle of every job as
+# Chrome trace events that Perfetto can load.
+#
+
+import os, sys, imp, atexit, pexpect, proc_check, signal, time, threading, json
+from testutils import *
+
+
+setup_tests()
+
+sendline("trace on trace_out.json")
+sendline("trace")
+expect("trace is on")
+sendline("sleep 0.2 | cat")
+sendline("sleep 10 &")
+expect("\\[1\\] \\d+")
+sendline("stop 1")
+sendline("jobs")
+expect("Stopped")
+sendline("bg 1")
+sendline("kill 1")
+expect("terminated")
+sendline("trace off")
+sendline("echo traced")
+expect("traced")
+
+with open("trace_out.json") as f:
+    events = json.load(f)
+os.unlink("trace_out.json")
+
+names = [e.get("name") for e in events]
+for name in ["FOREGROUND", "BACKGROUND", "STOPPED", "SIGSTOP", "SIGCONT", "SIGTERM", "spawn", "sleep", "cat", "terminal"]:
+    assert name in names, name + " was not traced"
+
+# Every stage has its spawn and a slice that ends with how it exited
+exits = [e["args"] for e in events if e["ph"] == "E" and "args" in e]
+assert {"exit": 0} in exits
+assert {"signal": "SIGTERM"} in exits
+
+test_success()
@@ -0,0 +1,274 @@
+/*
+ * Job lifecycle tracing in the Chrome trace event format.
+ *
+ * Each thread formats its events into a buffer of its own.  A full
+ * buffer, or one handed over by trace_flush(), goes onto a queue that
+ * a writer thread empties into the file, so the thread that traces
+ * never waits for the disk.  Buffers are written in the order they
+ * are queued.
+ *
+ * The file is a JSON array of events.  Every event is followed by a
+ * comma, and trace_stop() closes the array with a last event of its
+ * own.  A trace cut short by a crash lacks the closing bracket, which
+ * the viewers accept.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "shell_stats.h"
+#include "utils.h"
+
+#define TRACE_BUFFER_SIZE (64 * 1024)
+#define TRACE_EVENT_MAX 1024    /* Longer events are cut short */
+#define TRACE_JOB_TRACK_BASE (1 << 24)  /* Above any pid */
+
+struct trace_buffer {
+    struct trace_buffer *next;
+    size_t len;
+    char data[TRACE_BUFFER_SIZE];
+};
+
+static int trace_fd = -1;
+static pid_t trace_pid;
+
+static __thread struct trace_buffer *current;
+
+/* The queue of buffers for the writer thread */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct trace_buffer *queue_head, **queue_tail = &queue_head;
+static bool stopping;
+static pthread_t writer;
+
+static void
+write_all(const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(trace_fd, buf, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            return;             /* Nothing sensible to do; drop it */
+        buf += n;
+        len -= n;
+    }
+}
+
+static void *
+writer_main(void *arg)
+{
+    pthread_mutex_lock(&queue_lock);
+    for (;;) {
+        while (queue_head == NULL && !stopping)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        if (queue_head == NULL)
+            break;
+
+        struct trace_buffer *b = queue_head;
+        queue_head = NULL;
+        queue_tail = &queue_head;
+        pthread_mutex_unlock(&queue_lock);
+
+        while (b != NULL) {
+            struct trace_buffer *next = b->next;
+            write_all(b->data, b->len);
+            free(b);
+            b = next;
+        }
+        pthread_mutex_lock(&queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+bool
+trace_start(const char *path)
+{
+    if (trace_fd != -1)
+        return true;
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd == -1)
+        return false;
+    trace_pid = getpid();
+    stopping = false;
+    write_all("[\n", 2);
+
+    /* Signals such as SIGCHLD must go to the shell's thread, where
+     * they are read from signalfds, so the writer blocks them all */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0)
+        utils_fatal_error("cannot start trace writer: ");
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    static bool stop_at_exit;
+    if (!stop_at_exit)
+        atexit(trace_stop);
+    stop_at_exit = true;
+
+    trace_track_name(trace_pid, "cush");
+    return true;
+}
+
+void
+trace_stop(void)
+{
+    if (trace_fd == -1 || getpid() != trace_pid)
+        return;
+
+    trace_instant(trace_pid, "trace stopped", shell_stats_now(), NULL);
+    trace_flush();
+    pthread_mutex_lock(&queue_lock);
+    stopping = true;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(writer, NULL);
+
+    /* Replace the comma after the last event with the end of the array */
+    lseek(trace_fd, -2, SEEK_CUR);
+    write_all("\n]\n", 3);
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+bool
+trace_enabled(void)
+{
+    return trace_fd != -1;
+}
+
+void
+trace_flush(void)
+{
+    if (current == NULL || current->len == 0)
+        return;
+
+    pthread_mutex_lock(&queue_lock);
+    *queue_tail = current;
+    queue_tail = &current->next;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    current = NULL;
+}
+
+int
+trace_job_track(int n)
+{
+    return TRACE_JOB_TRACK_BASE + n;
+}
+
+/* Append printf-style output to 'buf', which has room for 'size' */
+static size_t
+append(char *buf, size_t len, size_t size, const char *fmt, ...)
+{
+    if (len >= size)
+        return len;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    return n < 0 ? len : len + n < size ? len + n : size - 1;
+}
+
+/* Append 's' as the contents of a JSON string */
+static size_t
+append_escaped(char *buf, size_t len, size_t size, const char *s)
+{
+    for (; *s != '\0' && len + 7 < size; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            len = append(buf, len, size, "\\%c", c);
+        else if (c < 0x20)
+            len = append(buf, len, size, "\\u%04x", c);
+        else
+            buf[len++] = c;
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* Format one event into the calling thread's buffer.  'ph' is the
+ * event type; 'dur' is only used for complete events. */
+static void
+emit(char ph, int tid, const char *name, long long ts, long long dur,
+     const char *args)
+{
+    if (trace_fd == -1 || getpid() != trace_pid)
+        return;
+
+    if (current != NULL && current->len + TRACE_EVENT_MAX > TRACE_BUFFER_SIZE)
+        trace_flush();
+    if (current == NULL) {
+        current = malloc(sizeof *current);
+        if (current == NULL)
+            return;
+        current->next = NULL;
+        current->len = 0;
+    }
+
+    /* A name that does not fit is cut short; args that do not fit are
+     * left out */
+    char *buf = current->data + current->len;
+    size_t size = TRACE_EVENT_MAX - 8, len = 0;
+    len = append(buf, len, size, "{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,"
+                 "\"ts\":%.3f", ph, trace_pid, tid, ts / 1e3);
+    if (ph == 'X')
+        len = append(buf, len, size, ",\"dur\":%.3f", dur / 1e3);
+    if (ph == 'i')
+        len = append(buf, len, size, ",\"s\":\"t\"");
+    if (name != NULL) {
+        len = append(buf, len, size, ",\"name\":\"");
+        len = append_escaped(buf, len, size, name);
+        len = append(buf, len, size, "\"");
+    }
+    if (args != NULL && len + strlen(args) + 10 < size)
+        len = append(buf, len, size, ",\"args\":%s", args);
+    len = append(buf, len, TRACE_EVENT_MAX, "},\n");
+    current->len += len;
+}
+
+void
+trace_track_name(int tid, const char *name)
+{
+    char args[256];
+    size_t len = append(args, 0, sizeof args, "{\"name\":\"");
+    len = append_escaped(args, len, sizeof args - 2, name);
+    append(args, len, sizeof args, "\"}");
+    emit('M', tid, "thread_name", 0, 0, args);
+}
+
+void
+trace_begin(int tid, const char *name, long long ts, const char *args)
+{
+    emit('B', tid, name, ts, 0, args);
+}
+
+void
+trace_end(int tid, long long ts, const char *args)
+{
+    emit('E', tid, NULL, ts, 0, args);
+}
+
+void
+trace_complete(int tid, const char *name, long long ts, long long dur,
+               const char *args)
+{
+    emit('X', tid, name, ts, dur, args);
+}
+
+void
+trace_instant(int tid, const char *name, long long ts, const char *args)
+{
+    emit('i', tid, name, ts, 0, args);
+}
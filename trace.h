@@ -0,0 +1,49 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdbool.h>
+
+/* Tracing of job lifecycles in the Chrome trace event format, which
+ * Perfetto and chrome://tracing load.  Events are formatted into a
+ * buffer of the calling thread; full buffers are written to the file
+ * by a writer thread, so the shell never waits for the disk.
+ *
+ * Events go onto tracks identified by 'tid': the shell's own pid, a
+ * child's pid, or one from trace_job_track().  Timestamps are
+ * CLOCK_MONOTONIC nanoseconds, as from shell_stats_now(). */
+
+/* Start writing events to 'path'.  Returns false with errno set if
+ * it cannot be created.  Does nothing if tracing is already on. */
+bool trace_start(const char *path);
+
+/* Write out all events and close the file */
+void trace_stop(void);
+
+/* True between trace_start() and trace_stop() */
+bool trace_enabled(void);
+
+/* Hand the calling thread's events to the writer thread */
+void trace_flush(void);
+
+/* The track that shows the states of the n-th job traced.  Job ids
+ * are reused, so they would put several jobs onto the same track. */
+int trace_job_track(int n);
+
+/* Name track 'tid' "name" in the viewer */
+void trace_track_name(int tid, const char *name);
+
+/* Begin a slice called 'name' on track 'tid' at time 'ts'.  'args',
+ * if not NULL, is a JSON object shown with it. */
+void trace_begin(int tid, const char *name, long long ts, const char *args);
+
+/* End the innermost slice on track 'tid' */
+void trace_end(int tid, long long ts, const char *args);
+
+/* A slice of 'dur' nanoseconds starting at 'ts' */
+void trace_complete(int tid, const char *name, long long ts, long long dur,
+                    const char *args);
+
+/* Something that happened at time 'ts' */
+void trace_instant(int tid, const char *name, long long ts, const char *args);
+
+#endif /* __TRACE_H */